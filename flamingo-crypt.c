@@ -0,0 +1,516 @@
+/***
+ *
+ * ELRO Flamingo rolling code cipher
+ *
+ * (C) Copyright 2022 Heiko Jehmlich <hje@jecons.de>
+ *
+ * scalar encrypt() / decrypt() for single 28bit messages and batch variants
+ * processing whole arrays with byte shuffle table lookups
+ *
+ *   - x86: SSSE3 (16 codes) and AVX2 (32 codes), selected at runtime
+ *   - ARM: NEON (16 codes), when compiled with -mfpu=neon
+ *
+ * The batch kernels deinterleave the codes into byte planes, so each of the
+ * 7 nibbles of 16 codes sits in one vector and a single pshufb / vtbl does
+ * the 16 entry key lookup for all of them.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CRYPT_X86
+#define TARGET_SSSE3		__attribute__((target("ssse3")))
+#define TARGET_AVX2			__attribute__((target("avx2")))
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define CRYPT_NEON
+#endif
+
+#include "flamingo.h"
+
+// flamingo encryption key
+static const uint8_t CKEY[16] = { 9, 6, 3, 8, 10, 0, 2, 12, 4, 14, 7, 5, 1, 15, 11, 13 };
+
+// decryption key (invers encryption key - exchanged index & value)
+static const uint8_t DKEY[16] = { 5, 12, 6, 2, 8, 11, 1, 10, 3, 0, 4, 14, 7, 15, 9, 13 };
+
+// per round lookup tables with the round offset already applied: CKEY[(i - r + 1) & 0x0F] and (DKEY[i] - r) & 0x0F
+static const uint8_t CKEY_R0[16] = { 6, 3, 8, 10, 0, 2, 12, 4, 14, 7, 5, 1, 15, 11, 13, 9 };
+static const uint8_t CKEY_R1[16] = { 9, 6, 3, 8, 10, 0, 2, 12, 4, 14, 7, 5, 1, 15, 11, 13 };
+static const uint8_t DKEY_R0[16] = { 5, 12, 6, 2, 8, 11, 1, 10, 3, 0, 4, 14, 7, 15, 9, 13 };
+static const uint8_t DKEY_R1[16] = { 4, 11, 5, 1, 7, 10, 0, 9, 2, 15, 3, 13, 6, 14, 8, 12 };
+
+uint32_t flamingo_encrypt(uint32_t message) {
+	uint32_t code = 0;
+	uint8_t n[7];
+	int i, r, idx;
+
+	// split into nibbles
+	for (i = 0; i < sizeof(n); i++)
+		n[i] = message >> (4 * i) & 0x0F;
+
+	// XOR encryption 2 rounds
+	for (r = 0; r <= 1; r++) {					// 2 encryption rounds
+		idx = (n[0] - r + 1) & 0x0F;
+		n[0] = CKEY[idx];						// encrypt first nibble
+		for (i = 1; i <= 5; i++) {				// encrypt 4 nibbles
+			idx = ((n[i] ^ n[i - 1]) - r + 1) & 0x0F;
+			n[i] = CKEY[idx];					// crypted with predecessor & key
+		}
+	}
+	n[6] = n[6] ^ 9;							// no  encryption
+
+	// build encrypted message
+	code = (n[6] << 24) | (n[5] << 20) | (n[4] << 16) | (n[3] << 12) | (n[2] << 8) | (n[1] << 4) | n[0];
+
+	// shift 2 bits right & copy lowest 2 bits of n[0] in msg bit 27/28
+	code = (code >> 2) | ((code & 3) << 0x1A);
+
+	return code;
+}
+
+uint32_t flamingo_decrypt(uint32_t code) {
+	uint32_t message = 0;
+	uint8_t n[7];
+	int i, r;
+
+	//shift 2 bits left & copy bit 27/28 to bit 1/2
+	code = ((code << 2) & 0x0FFFFFFF) | ((code & 0xC000000) >> 0x1A);
+
+	// split into nibbles
+	for (i = 0; i < sizeof(n); i++)
+		n[i] = code >> (4 * i) & 0x0F;
+
+	n[6] = n[6] ^ 9;							// no decryption
+	// XOR decryption 2 rounds
+	for (r = 0; r <= 1; r++) {					// 2 decryption rounds
+		for (i = 5; i >= 1; i--)				// decrypt 4 nibbles
+			n[i] = ((DKEY[n[i]] - r) & 0x0F) ^ n[i - 1];	// decrypted with predecessor & key
+		n[0] = (DKEY[n[0]] - r) & 0x0F;			// decrypt first nibble
+	}
+
+	// build message
+	for (i = sizeof(n) - 1; i >= 0; i--) {
+		message |= n[i];
+		if (i)
+			message <<= 4;
+	}
+
+	return message;
+}
+
+#ifdef CRYPT_X86
+
+// 4x4 byte transpose inside each dword group: bytes of 4 codes -> 4 byte planes of 4 codes
+#define TRANSPOSE_4X4		0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15
+
+TARGET_SSSE3
+static inline void planes_ssse3(const uint32_t *in, __m128i *b, int rotate) {
+	const __m128i t = _mm_setr_epi8(TRANSPOSE_4X4);
+	__m128i x[4];
+
+	for (int i = 0; i < 4; i++) {
+		x[i] = _mm_loadu_si128((const __m128i*) (in + 4 * i));
+		if (rotate) {
+			// shift 2 bits left & copy bit 27/28 to bit 1/2
+			__m128i l = _mm_and_si128(_mm_slli_epi32(x[i], 2), _mm_set1_epi32(0x0FFFFFFF));
+			__m128i h = _mm_srli_epi32(_mm_and_si128(x[i], _mm_set1_epi32(0x0C000000)), 0x1A);
+			x[i] = _mm_or_si128(l, h);
+		}
+		x[i] = _mm_shuffle_epi8(x[i], t);
+	}
+
+	__m128i t0 = _mm_unpacklo_epi32(x[0], x[1]);
+	__m128i t1 = _mm_unpackhi_epi32(x[0], x[1]);
+	__m128i t2 = _mm_unpacklo_epi32(x[2], x[3]);
+	__m128i t3 = _mm_unpackhi_epi32(x[2], x[3]);
+	b[0] = _mm_unpacklo_epi64(t0, t2);
+	b[1] = _mm_unpackhi_epi64(t0, t2);
+	b[2] = _mm_unpacklo_epi64(t1, t3);
+	b[3] = _mm_unpackhi_epi64(t1, t3);
+}
+
+TARGET_SSSE3
+static inline void codes_ssse3(const __m128i *b, uint32_t *out, int rotate) {
+	const __m128i t = _mm_setr_epi8(TRANSPOSE_4X4);
+	__m128i x[4];
+
+	__m128i t0 = _mm_shuffle_epi32(_mm_unpacklo_epi64(b[0], b[1]), _MM_SHUFFLE(3, 1, 2, 0));
+	__m128i t2 = _mm_shuffle_epi32(_mm_unpackhi_epi64(b[0], b[1]), _MM_SHUFFLE(3, 1, 2, 0));
+	__m128i t1 = _mm_shuffle_epi32(_mm_unpacklo_epi64(b[2], b[3]), _MM_SHUFFLE(3, 1, 2, 0));
+	__m128i t3 = _mm_shuffle_epi32(_mm_unpackhi_epi64(b[2], b[3]), _MM_SHUFFLE(3, 1, 2, 0));
+	x[0] = _mm_unpacklo_epi64(t0, t1);
+	x[1] = _mm_unpackhi_epi64(t0, t1);
+	x[2] = _mm_unpacklo_epi64(t2, t3);
+	x[3] = _mm_unpackhi_epi64(t2, t3);
+
+	for (int i = 0; i < 4; i++) {
+		x[i] = _mm_shuffle_epi8(x[i], t);
+		if (rotate) {
+			// shift 2 bits right & copy lowest 2 bits in bit 27/28
+			__m128i l = _mm_srli_epi32(x[i], 2);
+			__m128i h = _mm_slli_epi32(_mm_and_si128(x[i], _mm_set1_epi32(3)), 0x1A);
+			x[i] = _mm_or_si128(l, h);
+		}
+		_mm_storeu_si128((__m128i*) (out + 4 * i), x[i]);
+	}
+}
+
+TARGET_SSSE3
+static void encrypt16_ssse3(const uint32_t *in, uint32_t *out) {
+	const __m128i m = _mm_set1_epi8(0x0F);
+	const __m128i k[2] = { _mm_loadu_si128((const __m128i*) CKEY_R0), _mm_loadu_si128((const __m128i*) CKEY_R1) };
+	__m128i b[4], n[7];
+
+	planes_ssse3(in, b, 0);
+
+	// split into nibbles
+	for (int i = 0; i < 3; i++) {
+		n[2 * i] = _mm_and_si128(b[i], m);
+		n[2 * i + 1] = _mm_and_si128(_mm_srli_epi16(b[i], 4), m);
+	}
+	n[6] = _mm_and_si128(b[3], m);
+
+	// XOR encryption 2 rounds
+	for (int r = 0; r <= 1; r++) {
+		n[0] = _mm_shuffle_epi8(k[r], n[0]);
+		for (int i = 1; i <= 5; i++)
+			n[i] = _mm_shuffle_epi8(k[r], _mm_xor_si128(n[i], n[i - 1]));
+	}
+	n[6] = _mm_xor_si128(n[6], _mm_set1_epi8(9));
+
+	for (int i = 0; i < 3; i++)
+		b[i] = _mm_or_si128(n[2 * i], _mm_slli_epi16(n[2 * i + 1], 4));
+	b[3] = n[6];
+
+	codes_ssse3(b, out, 1);
+}
+
+TARGET_SSSE3
+static void decrypt16_ssse3(const uint32_t *in, uint32_t *out) {
+	const __m128i m = _mm_set1_epi8(0x0F);
+	const __m128i k[2] = { _mm_loadu_si128((const __m128i*) DKEY_R0), _mm_loadu_si128((const __m128i*) DKEY_R1) };
+	__m128i b[4], n[7];
+
+	planes_ssse3(in, b, 1);
+
+	// split into nibbles
+	for (int i = 0; i < 3; i++) {
+		n[2 * i] = _mm_and_si128(b[i], m);
+		n[2 * i + 1] = _mm_and_si128(_mm_srli_epi16(b[i], 4), m);
+	}
+	n[6] = _mm_xor_si128(_mm_and_si128(b[3], m), _mm_set1_epi8(9));
+
+	// XOR decryption 2 rounds
+	for (int r = 0; r <= 1; r++) {
+		for (int i = 5; i >= 1; i--)
+			n[i] = _mm_xor_si128(_mm_shuffle_epi8(k[r], n[i]), n[i - 1]);
+		n[0] = _mm_shuffle_epi8(k[r], n[0]);
+	}
+
+	for (int i = 0; i < 3; i++)
+		b[i] = _mm_or_si128(n[2 * i], _mm_slli_epi16(n[2 * i + 1], 4));
+	b[3] = n[6];
+
+	codes_ssse3(b, out, 0);
+}
+
+// AVX2 variants work the same way on two independent 128bit lanes
+TARGET_AVX2
+static inline void planes_avx2(const uint32_t *in, __m256i *b, int rotate) {
+	const __m256i t = _mm256_setr_epi8(TRANSPOSE_4X4, TRANSPOSE_4X4);
+	__m256i x[4];
+
+	for (int i = 0; i < 4; i++) {
+		x[i] = _mm256_loadu_si256((const __m256i*) (in + 8 * i));
+		if (rotate) {
+			__m256i l = _mm256_and_si256(_mm256_slli_epi32(x[i], 2), _mm256_set1_epi32(0x0FFFFFFF));
+			__m256i h = _mm256_srli_epi32(_mm256_and_si256(x[i], _mm256_set1_epi32(0x0C000000)), 0x1A);
+			x[i] = _mm256_or_si256(l, h);
+		}
+		x[i] = _mm256_shuffle_epi8(x[i], t);
+	}
+
+	__m256i t0 = _mm256_unpacklo_epi32(x[0], x[1]);
+	__m256i t1 = _mm256_unpackhi_epi32(x[0], x[1]);
+	__m256i t2 = _mm256_unpacklo_epi32(x[2], x[3]);
+	__m256i t3 = _mm256_unpackhi_epi32(x[2], x[3]);
+	b[0] = _mm256_unpacklo_epi64(t0, t2);
+	b[1] = _mm256_unpackhi_epi64(t0, t2);
+	b[2] = _mm256_unpacklo_epi64(t1, t3);
+	b[3] = _mm256_unpackhi_epi64(t1, t3);
+}
+
+TARGET_AVX2
+static inline void codes_avx2(const __m256i *b, uint32_t *out, int rotate) {
+	const __m256i t = _mm256_setr_epi8(TRANSPOSE_4X4, TRANSPOSE_4X4);
+	__m256i x[4];
+
+	__m256i t0 = _mm256_shuffle_epi32(_mm256_unpacklo_epi64(b[0], b[1]), _MM_SHUFFLE(3, 1, 2, 0));
+	__m256i t2 = _mm256_shuffle_epi32(_mm256_unpackhi_epi64(b[0], b[1]), _MM_SHUFFLE(3, 1, 2, 0));
+	__m256i t1 = _mm256_shuffle_epi32(_mm256_unpacklo_epi64(b[2], b[3]), _MM_SHUFFLE(3, 1, 2, 0));
+	__m256i t3 = _mm256_shuffle_epi32(_mm256_unpackhi_epi64(b[2], b[3]), _MM_SHUFFLE(3, 1, 2, 0));
+	x[0] = _mm256_unpacklo_epi64(t0, t1);
+	x[1] = _mm256_unpackhi_epi64(t0, t1);
+	x[2] = _mm256_unpacklo_epi64(t2, t3);
+	x[3] = _mm256_unpackhi_epi64(t2, t3);
+
+	for (int i = 0; i < 4; i++) {
+		x[i] = _mm256_shuffle_epi8(x[i], t);
+		if (rotate) {
+			__m256i l = _mm256_srli_epi32(x[i], 2);
+			__m256i h = _mm256_slli_epi32(_mm256_and_si256(x[i], _mm256_set1_epi32(3)), 0x1A);
+			x[i] = _mm256_or_si256(l, h);
+		}
+		_mm256_storeu_si256((__m256i*) (out + 8 * i), x[i]);
+	}
+}
+
+TARGET_AVX2
+static void encrypt32_avx2(const uint32_t *in, uint32_t *out) {
+	const __m256i m = _mm256_set1_epi8(0x0F);
+	const __m256i k[2] = { _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*) CKEY_R0)),
+			_mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*) CKEY_R1)) };
+	__m256i b[4], n[7];
+
+	planes_avx2(in, b, 0);
+
+	for (int i = 0; i < 3; i++) {
+		n[2 * i] = _mm256_and_si256(b[i], m);
+		n[2 * i + 1] = _mm256_and_si256(_mm256_srli_epi16(b[i], 4), m);
+	}
+	n[6] = _mm256_and_si256(b[3], m);
+
+	for (int r = 0; r <= 1; r++) {
+		n[0] = _mm256_shuffle_epi8(k[r], n[0]);
+		for (int i = 1; i <= 5; i++)
+			n[i] = _mm256_shuffle_epi8(k[r], _mm256_xor_si256(n[i], n[i - 1]));
+	}
+	n[6] = _mm256_xor_si256(n[6], _mm256_set1_epi8(9));
+
+	for (int i = 0; i < 3; i++)
+		b[i] = _mm256_or_si256(n[2 * i], _mm256_slli_epi16(n[2 * i + 1], 4));
+	b[3] = n[6];
+
+	codes_avx2(b, out, 1);
+}
+
+TARGET_AVX2
+static void decrypt32_avx2(const uint32_t *in, uint32_t *out) {
+	const __m256i m = _mm256_set1_epi8(0x0F);
+	const __m256i k[2] = { _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*) DKEY_R0)),
+			_mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*) DKEY_R1)) };
+	__m256i b[4], n[7];
+
+	planes_avx2(in, b, 1);
+
+	for (int i = 0; i < 3; i++) {
+		n[2 * i] = _mm256_and_si256(b[i], m);
+		n[2 * i + 1] = _mm256_and_si256(_mm256_srli_epi16(b[i], 4), m);
+	}
+	n[6] = _mm256_xor_si256(_mm256_and_si256(b[3], m), _mm256_set1_epi8(9));
+
+	for (int r = 0; r <= 1; r++) {
+		for (int i = 5; i >= 1; i--)
+			n[i] = _mm256_xor_si256(_mm256_shuffle_epi8(k[r], n[i]), n[i - 1]);
+		n[0] = _mm256_shuffle_epi8(k[r], n[0]);
+	}
+
+	for (int i = 0; i < 3; i++)
+		b[i] = _mm256_or_si256(n[2 * i], _mm256_slli_epi16(n[2 * i + 1], 4));
+	b[3] = n[6];
+
+	codes_avx2(b, out, 0);
+}
+
+#endif
+
+#ifdef CRYPT_NEON
+
+static inline uint8x16_t lookup_neon(uint8x16_t table, uint8x16_t idx) {
+#ifdef __aarch64__
+	return vqtbl1q_u8(table, idx);
+#else
+	uint8x8x2_t t = { { vget_low_u8(table), vget_high_u8(table) } };
+	return vcombine_u8(vtbl2_u8(t, vget_low_u8(idx)), vtbl2_u8(t, vget_high_u8(idx)));
+#endif
+}
+
+static void encrypt16_neon(const uint32_t *in, uint32_t *out) {
+	const uint8x16_t m = vdupq_n_u8(0x0F);
+	const uint8x16_t k[2] = { vld1q_u8(CKEY_R0), vld1q_u8(CKEY_R1) };
+	uint8x16_t n[7];
+
+	// vld4 deinterleaves the 4 bytes of each code into byte planes
+	uint8x16x4_t b = vld4q_u8((const uint8_t*) in);
+
+	for (int i = 0; i < 3; i++) {
+		n[2 * i] = vandq_u8(b.val[i], m);
+		n[2 * i + 1] = vshrq_n_u8(b.val[i], 4);
+	}
+	n[6] = vandq_u8(b.val[3], m);
+
+	for (int r = 0; r <= 1; r++) {
+		n[0] = lookup_neon(k[r], n[0]);
+		for (int i = 1; i <= 5; i++)
+			n[i] = lookup_neon(k[r], veorq_u8(n[i], n[i - 1]));
+	}
+	n[6] = veorq_u8(n[6], vdupq_n_u8(9));
+
+	for (int i = 0; i < 3; i++)
+		b.val[i] = vorrq_u8(n[2 * i], vshlq_n_u8(n[2 * i + 1], 4));
+	b.val[3] = n[6];
+	vst4q_u8((uint8_t*) out, b);
+
+	// shift 2 bits right & copy lowest 2 bits in bit 27/28
+	for (int i = 0; i < 4; i++) {
+		uint32x4_t c = vld1q_u32(out + 4 * i);
+		c = vorrq_u32(vshrq_n_u32(c, 2), vshlq_n_u32(vandq_u32(c, vdupq_n_u32(3)), 0x1A));
+		vst1q_u32(out + 4 * i, c);
+	}
+}
+
+static void decrypt16_neon(const uint32_t *in, uint32_t *out) {
+	const uint8x16_t m = vdupq_n_u8(0x0F);
+	const uint8x16_t k[2] = { vld1q_u8(DKEY_R0), vld1q_u8(DKEY_R1) };
+	uint32_t rotated[16];
+	uint8x16_t n[7];
+
+	// shift 2 bits left & copy bit 27/28 to bit 1/2
+	for (int i = 0; i < 4; i++) {
+		uint32x4_t c = vld1q_u32(in + 4 * i);
+		uint32x4_t l = vandq_u32(vshlq_n_u32(c, 2), vdupq_n_u32(0x0FFFFFFF));
+		uint32x4_t h = vshrq_n_u32(vandq_u32(c, vdupq_n_u32(0x0C000000)), 0x1A);
+		vst1q_u32(rotated + 4 * i, vorrq_u32(l, h));
+	}
+
+	uint8x16x4_t b = vld4q_u8((const uint8_t*) rotated);
+
+	for (int i = 0; i < 3; i++) {
+		n[2 * i] = vandq_u8(b.val[i], m);
+		n[2 * i + 1] = vshrq_n_u8(b.val[i], 4);
+	}
+	n[6] = veorq_u8(vandq_u8(b.val[3], m), vdupq_n_u8(9));
+
+	for (int r = 0; r <= 1; r++) {
+		for (int i = 5; i >= 1; i--)
+			n[i] = veorq_u8(lookup_neon(k[r], n[i]), n[i - 1]);
+		n[0] = lookup_neon(k[r], n[0]);
+	}
+
+	for (int i = 0; i < 3; i++)
+		b.val[i] = vorrq_u8(n[2 * i], vshlq_n_u8(n[2 * i + 1], 4));
+	b.val[3] = n[6];
+	vst4q_u8((uint8_t*) out, b);
+}
+
+#endif
+
+void flamingo_encrypt_batch(const uint32_t *messages, uint32_t *codes, int count) {
+	int i = 0;
+
+#ifdef CRYPT_X86
+	if (__builtin_cpu_supports("avx2"))
+		for (; i + 32 <= count; i += 32)
+			encrypt32_avx2(messages + i, codes + i);
+	if (__builtin_cpu_supports("ssse3"))
+		for (; i + 16 <= count; i += 16)
+			encrypt16_ssse3(messages + i, codes + i);
+#endif
+#ifdef CRYPT_NEON
+	for (; i + 16 <= count; i += 16)
+		encrypt16_neon(messages + i, codes + i);
+#endif
+
+	for (; i < count; i++)
+		codes[i] = flamingo_encrypt(messages[i]);
+}
+
+void flamingo_decrypt_batch(const uint32_t *codes, uint32_t *messages, int count) {
+	int i = 0;
+
+#ifdef CRYPT_X86
+	if (__builtin_cpu_supports("avx2"))
+		for (; i + 32 <= count; i += 32)
+			decrypt32_avx2(codes + i, messages + i);
+	if (__builtin_cpu_supports("ssse3"))
+		for (; i + 16 <= count; i += 16)
+			decrypt16_ssse3(codes + i, messages + i);
+#endif
+#ifdef CRYPT_NEON
+	for (; i + 16 <= count; i += 16)
+		decrypt16_neon(codes + i, messages + i);
+#endif
+
+	for (; i < count; i++)
+		messages[i] = flamingo_decrypt(codes[i]);
+}
+
+#ifdef FLAMINGO_CRYPT_MAIN
+
+// all messages of the 65536 possible transmitters for channel A-D, on/off and 4 rolling codes
+#define BENCH_CODES			(1 << 16) * 4 * 2 * 4
+
+static double seconds() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(const char *name, double elapsed, int count) {
+	printf("%-16s %10.1f Mcodes/s\n", name, count / elapsed / 1e6);
+}
+
+int main(int argc, char **argv) {
+	uint32_t *messages = malloc(sizeof(uint32_t) * BENCH_CODES);
+	uint32_t *codes = malloc(sizeof(uint32_t) * BENCH_CODES);
+	uint32_t *check = malloc(sizeof(uint32_t) * BENCH_CODES);
+	int count = 0, errors = 0;
+	double t;
+
+	for (uint32_t x = 0; x <= 0xFFFF; x++)
+		for (int channel = 1; channel <= 4; channel++)
+			for (int command = 0; command <= 2; command += 2)
+				for (int rolling = 0; rolling < 4; rolling++)
+					messages[count++] = x << 8 | rolling << 6 | command << 4 | channel;
+
+	t = seconds();
+	for (int i = 0; i < count; i++)
+		check[i] = flamingo_encrypt(messages[i]);
+	report("encrypt scalar", seconds() - t, count);
+
+	t = seconds();
+	flamingo_encrypt_batch(messages, codes, count);
+	report("encrypt batch", seconds() - t, count);
+
+	for (int i = 0; i < count; i++)
+		if (codes[i] != check[i])
+			errors++;
+
+	t = seconds();
+	for (int i = 0; i < count; i++)
+		check[i] = flamingo_decrypt(codes[i]);
+	report("decrypt scalar", seconds() - t, count);
+
+	t = seconds();
+	flamingo_decrypt_batch(codes, check, count);
+	report("decrypt batch", seconds() - t, count);
+
+	for (int i = 0; i < count; i++)
+		if (check[i] != messages[i])
+			errors++;
+
+	printf("%d codes, %d mismatches\n", count, errors);
+
+	free(messages);
+	free(codes);
+	free(check);
+	return errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+#endif
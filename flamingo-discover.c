@@ -0,0 +1,266 @@
+/***
+ *
+ * Transmitter id discovery for captured ELRO Flamingo rolling codes
+ *
+ * (C) Copyright 2022 Heiko Jehmlich <hje@jecons.de>
+ *
+ * Encrypts all 65536 transmitter ids x 16 channels x 4 commands x 4 rolling
+ * codes (optionally x 16 payloads) and reports which of them produce the
+ * captured 28bit codes.
+ *
+ * The transmitter id space is split into chunks, each thread owns an equal
+ * share of them and steals half of the remaining chunks of another thread
+ * when running out of work.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "utils.h"
+#include "flamingo.h"
+
+// transmitter ids per chunk of work
+#define CHUNK				64
+
+// open addressing table of captured codes, size must be a power of 2
+#define CODES				1024
+
+// captured codes and matches found
+#define MATCHES				4096
+
+typedef struct worker_t {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	uint32_t next;							// next chunk to work on
+	uint32_t end;							// end of own chunk range
+	uint32_t chunks;						// chunks done
+	uint32_t stolen;						// chunks stolen from others
+} worker_t;
+
+typedef struct match_t {
+	uint32_t code;
+	uint32_t message;
+} match_t;
+
+static uint32_t codes[CODES];
+static int ncodes, payloads = 1, nworkers;
+
+static worker_t *workers;
+
+static match_t matches[MATCHES];
+static int nmatches;
+static pthread_mutex_t matches_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint32_t hash(uint32_t code) {
+	return (code * 0x9E3779B1) >> 22 & (CODES - 1);
+}
+
+static void codes_add(uint32_t code) {
+	uint32_t h = hash(code);
+	while (codes[h] && codes[h] != code)
+		h = (h + 1) & (CODES - 1);
+	if (!codes[h])
+		ncodes++;
+	codes[h] = code;
+}
+
+static int codes_contains(uint32_t code) {
+	uint32_t h = hash(code);
+	while (codes[h]) {
+		if (codes[h] == code)
+			return 1;
+		h = (h + 1) & (CODES - 1);
+	}
+	return 0;
+}
+
+// take the next own chunk, or steal the upper half of the remaining chunks of the busiest other worker
+static int next_chunk(worker_t *w, uint32_t *chunk) {
+	pthread_mutex_lock(&w->lock);
+	if (w->next < w->end) {
+		*chunk = w->next++;
+		pthread_mutex_unlock(&w->lock);
+		return 1;
+	}
+	pthread_mutex_unlock(&w->lock);
+
+	worker_t *victim = NULL;
+	uint32_t most = 0;
+	for (worker_t *v = workers; v < workers + nworkers; v++) {
+		uint32_t left = v->end - v->next;
+		if (v != w && left > most) {
+			most = left;
+			victim = v;
+		}
+	}
+	if (victim == NULL)
+		return 0;
+
+	pthread_mutex_lock(&victim->lock);
+	uint32_t left = victim->end - victim->next;
+	if (left == 0) {
+		pthread_mutex_unlock(&victim->lock);
+		return next_chunk(w, chunk);
+	}
+	uint32_t half = left - left / 2;
+	uint32_t from = victim->end - half;
+	victim->end = from;
+	pthread_mutex_unlock(&victim->lock);
+
+	pthread_mutex_lock(&w->lock);
+	w->next = from + 1;
+	w->end = from + half;
+	w->stolen += half;
+	pthread_mutex_unlock(&w->lock);
+
+	*chunk = from;
+	return 1;
+}
+
+static void search(uint32_t xmitter, uint32_t *messages, uint32_t *encrypted) {
+	int count = 0;
+
+	// low byte covers rolling code, command and channel
+	for (uint32_t payload = 0; payload < payloads; payload++)
+		for (uint32_t low = 0; low <= 0xFF; low++)
+			messages[count++] = payload << 24 | xmitter << 8 | low;
+
+	flamingo_encrypt_batch(messages, encrypted, count);
+
+	for (int i = 0; i < count; i++) {
+		if (!codes_contains(encrypted[i]))
+			continue;
+
+		pthread_mutex_lock(&matches_lock);
+		if (nmatches < MATCHES) {
+			matches[nmatches].code = encrypted[i];
+			matches[nmatches].message = messages[i];
+			nmatches++;
+		}
+		pthread_mutex_unlock(&matches_lock);
+	}
+}
+
+static void* work(void *arg) {
+	worker_t *w = (worker_t*) arg;
+	uint32_t *messages = malloc(sizeof(uint32_t) * 256 * payloads);
+	uint32_t *encrypted = malloc(sizeof(uint32_t) * 256 * payloads);
+	uint32_t chunk;
+
+	while (next_chunk(w, &chunk)) {
+		for (uint32_t x = chunk * CHUNK; x < (chunk + 1) * CHUNK; x++)
+			search(x, messages, encrypted);
+		w->chunks++;
+	}
+
+	free(messages);
+	free(encrypted);
+	return (void*) 0;
+}
+
+static int compare_match(const void *a, const void *b) {
+	const match_t *x = a, *y = b;
+	uint32_t mx = x->message & 0xFFFFFF00, my = y->message & 0xFFFFFF00;
+	if (mx != my)
+		return mx < my ? -1 : 1;
+	return (x->message > y->message) - (x->message < y->message);
+}
+
+static void report() {
+	uint32_t xmitter = UINT32_MAX;
+
+	qsort(matches, nmatches, sizeof(match_t), &compare_match);
+	for (match_t *m = matches; m < matches + nmatches; m++) {
+		uint32_t x = m->message >> 8 & 0xFFFF;
+		if (x != xmitter) {
+			xmitter = x;
+			printf("transmitter 0x%04x", x);
+			for (int i = 0; i < ARRAY_SIZE(REMOTES); i++)
+				if (REMOTES[i] == x)
+					printf(" (remote %d)", i + 1);
+			printf("\n");
+		}
+		int channel = m->message & 0x0F;
+		printf("  0x%08x => channel %c (%2d) command %d rolling %d payload 0x%x\n", m->code, channel ? 'A' + channel - 1 : '-', channel,
+				m->message >> 4 & 0x03, m->message >> 6 & 0x03, m->message >> 24 & 0x0F);
+	}
+}
+
+static int usage() {
+	printf("Usage: flamingo-discover [-p] [-t threads] <code> [code ...]\n");
+	printf("    -p         search all 16 payloads, default payload 0 only\n");
+	printf("    -t threads number of threads, default number of cpus\n");
+	printf("    <code>     captured 28bit rc1 code, e.g. 0x0e6bd68d\n");
+	return EXIT_FAILURE;
+}
+
+int main(int argc, char **argv) {
+	struct timespec t0, t1;
+	int c;
+
+	nworkers = sysconf(_SC_NPROCESSORS_ONLN);
+	while ((c = getopt(argc, argv, "pt:")) != -1)
+		switch (c) {
+		case 'p':
+			payloads = 16;
+			break;
+		case 't':
+			nworkers = atoi(optarg);
+			break;
+		default:
+			return usage();
+		}
+
+	if (optind == argc || nworkers < 1)
+		return usage();
+
+	for (int i = optind; i < argc; i++) {
+		uint32_t code = strtoul(argv[i], NULL, 0);
+		if (code == 0 || code > 0x0FFFFFFF) {
+			printf("not a 28bit code: %s\n", argv[i]);
+			return usage();
+		}
+		if (ncodes == CODES / 2) {
+			printf("too many codes\n");
+			return usage();
+		}
+		codes_add(code);
+	}
+
+	// distribute the chunks evenly
+	uint32_t chunks = 0x10000 / CHUNK;
+	workers = calloc(nworkers, sizeof(worker_t));
+	for (int i = 0; i < nworkers; i++) {
+		pthread_mutex_init(&workers[i].lock, NULL);
+		workers[i].next = chunks * i / nworkers;
+		workers[i].end = chunks * (i + 1) / nworkers;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (int i = 0; i < nworkers; i++)
+		if (pthread_create(&workers[i].thread, NULL, &work, &workers[i])) {
+			printf("Error creating thread\n");
+			return EXIT_FAILURE;
+		}
+	for (int i = 0; i < nworkers; i++)
+		pthread_join(workers[i].thread, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	report();
+
+	double elapsed = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+	unsigned long long searched = 0x10000ULL * 256 * payloads;
+	printf("%d of %d codes matched, %llu messages in %.2f s (%.1f Mmsg/s) on %d threads\n", nmatches, ncodes, searched, elapsed,
+			searched / elapsed / 1e6, nworkers);
+	for (int i = 0; i < nworkers; i++)
+		printf("  thread %d: %u chunks, %u stolen\n", i, workers[i].chunks, workers[i].stolen);
+
+	free(workers);
+	return nmatches ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,112 @@
+/***
+ *
+ * Replay edge recordings through the Flamingo decoders
+ *
+ * (C) Copyright 2022 Heiko Jehmlich <hje@jecons.de>
+ *
+ * Feeds recordings written by "flamingo -r <file>" through all receiver state
+ * machines as fast as the CPU allows, prints the decoded frames and measures
+ * the throughput of the decoder hot loop.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "gpio.h"
+#include "utils.h"
+#include "flamingo.h"
+
+static int verbose, loops = 1;
+
+static void print_frame(const flamingo_frame_t *f, int valid) {
+	if (f->protocol == FLAMINGO_RC3) {
+		printf("%10u rc%d %s\n", f->ts, f->protocol, f->multibit);
+		return;
+	}
+
+	printf("%10u rc%d 0x%08x => 0x%08x xmitter = 0x%04x channel = %d command = %d payload = 0x%02x rolling = %d%s\n", f->ts, f->protocol, f->code,
+			f->message, f->xmitter, f->channel, f->command, f->payload, f->rolling, valid ? "" : " (unknown)");
+}
+
+static int replay(const char *path) {
+	flamingo_frame_t frames[FLAMINGO_DECODERS];
+	flamingo_receiver_t r;
+	gpio_replay_t rp;
+	gpio_edge_t e;
+	struct timespec t0, t1;
+	uint32_t counts[FLAMINGO_SF500 + 1], valid = 0;
+	unsigned long long edges = 0;
+
+	if (gpio_replay_open(&rp, path) < 0)
+		return -1;
+
+	memset(counts, 0, sizeof(counts));
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (int loop = 0; loop < loops; loop++) {
+		flamingo_receiver_init(&r);
+		gpio_replay_rewind(&rp);
+
+		while (gpio_replay_next(&rp, &e)) {
+			int n = flamingo_receive_edge(&r, e.ts, e.level, frames);
+			edges++;
+
+			// decode and print only in the first pass, the others measure the state machines alone
+			for (int i = 0; i < n && loop == 0; i++) {
+				flamingo_frame_t *f = &frames[i];
+				int v = flamingo_frame_decode(f);
+				counts[f->protocol]++;
+				valid += v;
+				if (verbose)
+					print_frame(f, v);
+			}
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	double elapsed = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+	printf("%s: %u edges%s, rc1 %u rc2 %u rc3 %u rc4 %u sf500 %u, %u of our remotes\n", path, rp.header->edges,
+			rp.header->edges ? "" : " (not closed)", counts[FLAMINGO_RC1], counts[FLAMINGO_RC2], counts[FLAMINGO_RC3], counts[FLAMINGO_RC4],
+			counts[FLAMINGO_SF500], valid);
+	printf("%s: %llu edges in %.3f s, %.1f Medges/s\n", path, edges, elapsed, edges / elapsed / 1e6);
+
+	gpio_replay_close(&rp);
+	return 0;
+}
+
+static int usage() {
+	printf("Usage: flamingo-replay [-v] [-n loops] <file> [file ...]\n");
+	printf("    -v         print all decoded frames\n");
+	printf("    -n loops   replay each file loops times for throughput measurement\n");
+	printf("    <file>     edge recording written by flamingo -r <file>\n");
+	return EXIT_FAILURE;
+}
+
+int main(int argc, char **argv) {
+	int c, ret = EXIT_SUCCESS;
+
+	while ((c = getopt(argc, argv, "vn:")) != -1)
+		switch (c) {
+		case 'v':
+			verbose = 1;
+			break;
+		case 'n':
+			loops = atoi(optarg);
+			break;
+		default:
+			return usage();
+		}
+
+	if (optind == argc || loops < 1)
+		return usage();
+
+	for (int i = optind; i < argc; i++)
+		if (replay(argv[i]) < 0)
+			ret = EXIT_FAILURE;
+
+	return ret;
+}
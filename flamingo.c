@@ -20,47 +20,412 @@
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <math.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/file.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
 
 #include "gpio.h"
 #include "utils.h"
 #include "flamingo.h"
 
-// flamingo encryption key
-static const uint8_t CKEY[16] = { 9, 6, 3, 8, 10, 0, 2, 12, 4, 14, 7, 5, 1, 15, 11, 13 };
+// decoded frames waiting for the handler
+#define RX_QUEUE			16
 
-static uint32_t encrypt(uint32_t message) {
-	uint32_t code = 0;
-	uint8_t n[7];
-	int i, r, idx;
+// protocol descriptor tables are indexed by protocol number
+#define PROTOCOLS_MAX		(FLAMINGO_SF500 + 1)
 
-	// split into nibbles
-	for (i = 0; i < sizeof(n); i++)
-		n[i] = message >> (4 * i) & 0x0F;
+// learned timings of one pulse class, one line per class in FLAMINGO_CALIBRATION
+#define CALIBRATIONS		256
 
-	// XOR encryption 2 rounds
-	for (r = 0; r <= 1; r++) {					// 2 encryption rounds
-		idx = (n[0] - r + 1) & 0x0F;
-		n[0] = CKEY[idx];						// encrypt first nibble
-		for (i = 1; i <= 5; i++) {				// encrypt 4 nibbles
-			idx = ((n[i] ^ n[i - 1]) - r + 1) & 0x0F;
-			n[i] = CKEY[idx];					// crypted with predecessor & key
+// learned window per pulse class: at least the jitter of our own player, below half the distance of the rc2 and SF-500R syncs
+#define CAL_TOLERANCE_MIN	20
+#define CAL_TOLERANCE_MAX	((T2X * 2 - T2L * 8) / 2 - 1)
+
+// repeats of a frame within this many ms after the previous one are folded into the first
+#define DEDUP_WINDOW		500
+#define DEDUP_SLOTS			16
+
+// pending transmit jobs
+#define TX_QUEUE			32
+
+// gap between the rolling codes of one job, filled with frames of other jobs: four sockets with all rolling codes are
+// 16 frames of about 0.57s each, so switching them takes about 9s instead of 21s one job after the other
+#define TX_GAP				1000
+
+// 433MHz short range devices: 10% duty cycle, bucket allows a burst of 36s airtime
+#define TX_DUTY				10
+#define TX_BUCKET			(36 * 1000 * 1000)
+
+// listen before talk: band is busy for a window after the last edge of a frame in progress, random back-off on top
+#define LBT_WINDOW			20
+#define LBT_BACKOFF			100
+#define LBT_RETRIES			8
+
+// precomputed rc1 codes of all known remotes: channels A-P, off/on, 4 rolling codes
+#define CB_REMOTES			ARRAY_SIZE(REMOTES)
+#define CB_CHANNELS			16
+#define CB_CODES			(CB_REMOTES * CB_CHANNELS * 2 * 4)
+
+// open addressing table for receive validation, size must be a power of 2 and at least twice CB_CODES
+#define CB_HASH				2048
+
+typedef struct codebook_entry_t {
+	uint32_t code;
+	uint32_t message;
+} codebook_entry_t;
+
+typedef struct tx_job_t {
+	int id;
+	int prio;
+	int remote;
+	char channel;
+	int command;
+	flamingo_done_t done;
+	void *arg;
+	int rolling;							// next rolling code to send
+	int last;								// last rolling code to send
+	int backoffs;							// back-offs of the next rolling code
+	int throttled;							// next rolling code already counted as throttled
+	uint64_t due;							// not before this time in ms
+} tx_job_t;
+
+//
+// rc1 pattern (28bit) and rc4 pattern (24bit)
+//
+// short high pulse followed by long low pulse or long high + short low pulse, no clock
+//       _              ___
+// 0 = _| |___    1 = _|   |_
+//
+// measure HIGH pulse length: short=0 long=1
+//
+// rc2 pattern (32bit), SF-500R uses the same with a shorter sync
+//
+// clock pulse + data pulse, either short or long distance from clock to data pulse
+//       _   _               _      _
+// 0 = _| |_| |____    1 = _| |____| |_
+//
+// measure LOW pulses, the space between clock and data pulse decides, then skip the space to the next clock
+//
+static const gpio_protocol_t PROTOCOLS[PROTOCOLS_MAX] = {
+	[FLAMINGO_RC1] = {
+		.bits = 28, .repeat = 4,
+		.sync = { T1, T1 * 15 },
+		.zero = { T1, T1 * 3 },
+		.one = { T1 * 3, T1 },
+		.pause = T1 * 50,
+		.level = 1, .symbols = 1, .threshold = T1 * 2, .tolerance = 80,
+	},
+	[FLAMINGO_RC2] = {
+		.bits = 32, .repeat = 3,
+		.sync = { T2H, T2X * 2 },
+		.zero = { T2H, T2L, T2H, T2X },
+		.one = { T2H, T2X, T2H, T2L },
+		.tail = { T2H, T2L },
+		.gap = T2X * 2 * 4,
+		.pause = T2X * 2 * 50,
+		.level = 0, .symbols = 2, .threshold = T2X / 2, .tolerance = 50,
+	},
+	[FLAMINGO_RC4] = {
+		.bits = 24, .repeat = 4,
+		.sync = { T1, T1 * 31 },
+		.zero = { T1, T1 * 3 },
+		.one = { T1 * 3, T1 },
+		.pause = T1 * 50,
+		.level = 1, .symbols = 1, .threshold = T1 * 2, .tolerance = 100,
+	},
+	[FLAMINGO_SF500] = {
+		.bits = 32, .repeat = 5,
+		.sync = { T2H, T2L * 8 },
+		.zero = { T2H, T2L, T2H, T2X },
+		.one = { T2H, T2X, T2H, T2L },
+		.tail = { T2H, T2L },
+		.gap = T2X * 2 * 4,
+		.pause = T2X * 2 * 50,
+		.level = 0, .symbols = 2, .threshold = T2X / 2, .tolerance = 50,
+	},
+};
+
+typedef struct dedup_t {
+	uint32_t key;
+	uint32_t ts;							// last repeat seen
+	uint32_t count;							// repeats folded
+} dedup_t;
+
+// edge capture and decoders of one RX pin
+typedef struct rx_t {
+	const char *pin;
+	gpio_ring_t *ring;
+	gpio_capture_t *capture;
+	flamingo_receiver_t receiver;
+	pthread_t thread;
+	int index;
+} rx_t;
+
+typedef struct calibration_t {
+	uint16_t xmitter;
+	int protocol;
+	int level;
+	uint16_t nominal;						// pulse length in the default descriptor
+	uint16_t measured;						// cluster centroid
+	uint16_t tolerance;						// accepted deviation from the centroid
+} calibration_t;
+
+// the decoder timings calibration changes, kept apart so that the decoders run with the constant PROTOCOLS descriptors
+typedef struct window_t {
+	uint16_t sync;							// sync low
+	uint16_t tolerance;						// accepted deviation of the sync low
+	uint16_t threshold;						// measured pulses longer than this are a 1
+} window_t;
+
+// learned windows of the decoders, and calibrated copies of PROTOCOLS for the encoders per remote
+static window_t windows[PROTOCOLS_MAX];
+static gpio_protocol_t tx_protocols[ARRAY_SIZE(REMOTES)][PROTOCOLS_MAX];
+
+static calibration_t calibrations[CALIBRATIONS];
+static int ncalibrations;
+
+static gpio_pin_t tx;
+static int lock_fd = -1;
+
+static const char *RX_PINS[] = { RX,
+#ifdef RX2
+		RX2,
+#endif
+		};
+
+static flamingo_handler_t handler;
+static flamingo_stats_t stats;
+static gpio_recorder_t *recorder;
+static rx_t receivers[FLAMINGO_RECEIVERS];
+static int nreceivers;
+static pthread_t thread_dispatch, thread_tx;
+
+// recently delivered frames, shared by the decoder threads of all receivers
+static dedup_t dedup[DEDUP_SLOTS];
+static int dedup_window = DEDUP_WINDOW;
+
+// deliver frames failing the codebook check too, flagged as not valid
+static int promiscuous;
+static pthread_mutex_t dedup_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// bounded frame queue between decoder and handler thread, the oldest frame is overwritten when full
+static flamingo_frame_t queue[RX_QUEUE];
+static int queue_head, queue_count, queue_efd = -1;
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// queued and running transmit jobs, the worker picks the highest priority one that is due
+static tx_job_t tx_queue[TX_QUEUE];
+static int tx_count, tx_seq, tx_stop;
+static uint64_t tx_tokens, tx_refill;
+
+// carrier sense state in CLOCK_MONOTONIC us, the kernel's edge timestamp clock
+static int lbt_window = LBT_WINDOW;
+static uint32_t rx_busy, tx_on, tx_from, tx_until;
+static pthread_mutex_t tx_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t tx_cond;
+
+static uint32_t codebook[CB_REMOTES][CB_CHANNELS][2][4];
+static codebook_entry_t codebook_hash[CB_HASH];
+_Static_assert(CB_HASH >= 2 * CB_CODES && (CB_HASH & (CB_HASH - 1)) == 0, "CB_HASH must be a power of 2 and at least twice CB_CODES");
+
+// bitmap of known transmitter id's
+static uint32_t known[0x10000 / 32];
+
+static void flamingo28_decode(flamingo_frame_t *f) {
+	f->payload = f->message >> 24 & 0x0F;
+	f->xmitter = f->message >> 8 & 0xFFFF;
+	f->rolling = f->message >> 6 & 0x03;
+	f->command = f->message >> 4 & 0x03;
+	f->channel = f->message & 0x0F;
+}
+
+static void flamingo32_decode(flamingo_frame_t *f) {
+	f->payload = f->message >> 24 & 0x0F;
+	f->xmitter = f->message >> 8 & 0xFFFF;
+	f->rolling = 0;
+	f->command = f->message >> 4 & 0x0F;
+	f->channel = f->message & 0x0F;
+}
+
+static void sf500_decode(flamingo_frame_t *f) {
+	f->xmitter = f->message >> 16 & 0xFFFF;
+	f->payload = f->message >> 8 & 0x0F;
+	f->rolling = 0;
+	f->command = f->message >> 4 & 0x03;
+	f->channel = f->message & 0x0F;
+}
+
+static uint32_t flamingo28_message(uint16_t xmitter, char channel, char command, char payload, char rolling) {
+	uint32_t message = (payload & 0x0F) << 24 | xmitter << 8 | (rolling << 6 & 0xC0) | (command & 0x03) << 4 | (channel & 0x0F);
+	return message;
+}
+
+static uint32_t codebook_slot(uint32_t code) {
+	return (code * 0x9E3779B1) >> 16 & (CB_HASH - 1);
+}
+
+// encrypt all codes of our remotes once, sending becomes a table lookup and receiving a hash lookup without decryption
+static void codebook_init() {
+	uint32_t messages[CB_CODES], codes[CB_CODES];
+	int i = 0;
+
+	for (int r = 0; r < CB_REMOTES; r++)
+		for (int c = 0; c < CB_CHANNELS; c++)
+			for (int cmd = 0; cmd < 2; cmd++)
+				for (int roll = 0; roll < 4; roll++)
+					messages[i++] = flamingo28_message(REMOTES[r], c + 1, cmd ? 2 : 0, 0, roll);
+
+	flamingo_encrypt_batch(messages, codes, CB_CODES);
+
+	memset(codebook_hash, 0, sizeof(codebook_hash));
+	for (i = 0; i < CB_CODES; i++) {
+		uint32_t slot = codebook_slot(codes[i]);
+		for (int probe = 0; codebook_hash[slot].code && probe < CB_HASH; probe++)
+			slot = (slot + 1) & (CB_HASH - 1);
+		if (codebook_hash[slot].code) {
+			xlog("FLAMINGO codebook hash table full");
+			break;
+		}
+		codebook_hash[slot].code = codes[i];
+		codebook_hash[slot].message = messages[i];
+	}
+	memcpy(codebook, codes, sizeof(codebook));
+
+	memset(known, 0, sizeof(known));
+	for (int r = 0; r < CB_REMOTES; r++)
+		known[REMOTES[r] / 32] |= 1 << (REMOTES[r] % 32);
+}
+
+// replace all pulses of a level with the nominal length by the measured one
+static void calibrate_pulses(gpio_protocol_t *proto, int level, uint16_t nominal, uint16_t measured) {
+	if (level == 1 && proto->sync[0] == nominal)
+		proto->sync[0] = measured;
+	if (level == 0 && proto->sync[1] == nominal)
+		proto->sync[1] = measured;
+	for (int i = 0; i < GPIO_SYMBOL_SIZE; i++) {
+		if ((i & 1) == !level && proto->zero[i] == nominal)
+			proto->zero[i] = measured;
+		if ((i & 1) == !level && proto->one[i] == nominal)
+			proto->one[i] = measured;
+	}
+	if (level == 1 && proto->tail[0] == nominal)
+		proto->tail[0] = measured;
+	if (level == 0 && proto->tail[1] == nominal)
+		proto->tail[1] = measured;
+}
+
+// encoders send with the timings of the remote they impersonate, decoders accept the timings of all learned remotes
+static void calibration_apply() {
+	uint32_t lo[PROTOCOLS_MAX], hi[PROTOCOLS_MAX], n[PROTOCOLS_MAX];
+	uint32_t shorts[PROTOCOLS_MAX], longs[PROTOCOLS_MAX], nshort[PROTOCOLS_MAX], nlong[PROTOCOLS_MAX];
+
+	for (int p = 0; p < PROTOCOLS_MAX; p++) {
+		windows[p].sync = PROTOCOLS[p].sync[1];
+		windows[p].tolerance = PROTOCOLS[p].tolerance;
+		windows[p].threshold = PROTOCOLS[p].threshold;
+	}
+	for (int r = 0; r < ARRAY_SIZE(REMOTES); r++)
+		memcpy(tx_protocols[r], PROTOCOLS, sizeof(PROTOCOLS));
+	memset(n, 0, sizeof(n));
+	memset(shorts, 0, sizeof(shorts));
+	memset(longs, 0, sizeof(longs));
+	memset(nshort, 0, sizeof(nshort));
+	memset(nlong, 0, sizeof(nlong));
+
+	for (calibration_t *c = calibrations; c < calibrations + ncalibrations; c++) {
+		if (c->protocol < 1 || c->protocol >= PROTOCOLS_MAX || !PROTOCOLS[c->protocol].bits)
+			continue;
+
+		for (int r = 0; r < ARRAY_SIZE(REMOTES); r++)
+			if (REMOTES[r] == c->xmitter)
+				calibrate_pulses(&tx_protocols[r][c->protocol], c->level, c->nominal, c->measured);
+
+		// decoder: union of all sync windows, threshold between the averaged short and long data pulses
+		const gpio_protocol_t *d = &PROTOCOLS[c->protocol];
+		int i = d->level ? 0 : 1, p = c->protocol;
+		if (c->level == 0 && c->nominal == d->sync[1]) {
+			uint16_t tolerance = c->tolerance > CAL_TOLERANCE_MAX ? CAL_TOLERANCE_MAX : c->tolerance;
+			if (!n[p] || c->measured - tolerance < lo[p])
+				lo[p] = c->measured - tolerance;
+			if (!n[p] || c->measured + tolerance > hi[p])
+				hi[p] = c->measured + tolerance;
+			n[p]++;
+		} else if (c->level == d->level && c->nominal == d->zero[i]) {
+			shorts[p] += c->measured;
+			nshort[p]++;
+		} else if (c->level == d->level && c->nominal == d->one[i]) {
+			longs[p] += c->measured;
+			nlong[p]++;
 		}
 	}
-	n[6] = n[6] ^ 9;							// no  encryption
 
-	// build encrypted message
-	code = (n[6] << 24) | (n[5] << 20) | (n[4] << 16) | (n[3] << 12) | (n[2] << 8) | (n[1] << 4) | n[0];
+	for (int p = 1; p < PROTOCOLS_MAX; p++) {
+		if (n[p]) {
+			windows[p].sync = (lo[p] + hi[p]) / 2;
+			windows[p].tolerance = (hi[p] - lo[p]) / 2;
+		}
+		if (nshort[p] && nlong[p])
+			windows[p].threshold = (shorts[p] / nshort[p] + longs[p] / nlong[p]) / 2;
+	}
+
+	// the unions of several remotes may still reach into each other, then both decoders fall back to the nominal windows
+	for (int p = 1; p < PROTOCOLS_MAX; p++)
+		for (int q = p + 1; q < PROTOCOLS_MAX; q++) {
+			if (!PROTOCOLS[p].bits || !PROTOCOLS[q].bits || PROTOCOLS[p].level != PROTOCOLS[q].level)
+				continue;
+			int distance = abs((int) windows[p].sync - (int) windows[q].sync);
+			if (distance >= windows[p].tolerance + windows[q].tolerance)
+				continue;
+			xlog("FLAMINGO calibrated sync windows of rc%d and rc%d overlap, using nominal ones", p, q);
+			windows[p].sync = PROTOCOLS[p].sync[1];
+			windows[p].tolerance = PROTOCOLS[p].tolerance;
+			windows[q].sync = PROTOCOLS[q].sync[1];
+			windows[q].tolerance = PROTOCOLS[q].tolerance;
+		}
+}
 
-	// shift 2 bits right & copy lowest 2 bits of n[0] in msg bit 27/28
-	code = (code >> 2) | ((code & 3) << 0x1A);
+static void calibration_load() {
+	unsigned int xmitter, protocol, level, nominal, measured, tolerance;
+	char line[128];
 
-	return code;
+	ncalibrations = 0;
+	FILE *f = fopen(FLAMINGO_CALIBRATION, "r");
+	if (f != NULL) {
+		while (ncalibrations < CALIBRATIONS && fgets(line, sizeof(line), f)) {
+			if (sscanf(line, "%x %u %u %u %u %u", &xmitter, &protocol, &level, &nominal, &measured, &tolerance) != 6)
+				continue;
+			calibration_t *c = &calibrations[ncalibrations++];
+			c->xmitter = xmitter;
+			c->protocol = protocol;
+			c->level = level;
+			c->nominal = nominal;
+			c->measured = measured;
+			c->tolerance = tolerance;
+		}
+		fclose(f);
+	}
+	calibration_apply();
 }
 
-static uint32_t flamingo28_encode(uint16_t xmitter, char channel, char command, char payload, char rolling) {
-	uint32_t message = (payload & 0x0F) << 24 | xmitter << 8 | (rolling << 6 & 0xC0) | (command & 0x03) << 4 | (channel & 0x0F);
-	uint32_t code = encrypt(message);
-	return code;
+static const codebook_entry_t* codebook_lookup(uint32_t code) {
+	uint32_t slot = codebook_slot(code);
+	for (int probe = 0; codebook_hash[slot].code && probe < CB_HASH; probe++) {
+		if (codebook_hash[slot].code == code)
+			return &codebook_hash[slot];
+		slot = (slot + 1) & (CB_HASH - 1);
+	}
+	return NULL;
+}
+
+static int known_xmitter(uint16_t xmitter) {
+	return known[xmitter / 32] & (1 << (xmitter % 32)) ? 1 : 0;
 }
 
 static uint32_t flamingo32_encode(uint16_t xmitter, char channel, char command, char payload) {
@@ -68,14 +433,735 @@ static uint32_t flamingo32_encode(uint16_t xmitter, char channel, char command,
 	return message;
 }
 
-// TODO
-static uint32_t flamingo24_encode(uint16_t xmitter, char channel, char command, char payload) {
+static void frame(flamingo_decoder_t *d, flamingo_frame_t *f, int protocol, uint32_t ts) {
+	memset(f, 0, sizeof(*f));
+	f->protocol = protocol;
+	f->ts = ts;
+	f->code = d->code;
+	if (protocol == FLAMINGO_RC3)
+		memcpy(f->multibit, d->multibit, sizeof(f->multibit));
+}
+
+// decoder for all protocols with a descriptor, inlined with a constant descriptor into flamingo_receive_edge(),
+// only the learned window is read at runtime
+static inline int decode(flamingo_decoder_t *d, const gpio_protocol_t *proto, const window_t *w, uint32_t pulse, int state, uint32_t ts,
+		flamingo_frame_t *f) {
+	// the edge ending a pulse of the measured level
+	if (d->bits && state != proto->level) {
+		// clock pulse -> skip
+		if (d->symbol) {
+			if (++d->symbol == proto->symbols)
+				d->symbol = 0;
+			return 0;
+		}
+
+		// data pulse: short=0 long=1
+		d->code = d->code << 1 | (pulse > w->threshold ? 1 : 0);
+		d->symbol = proto->symbols > 1 ? 1 : 0;
+		if (--d->bits == 0) {
+			frame(d, f, d->protocol, ts);
+			return 1;
+		}
+		return 0;
+	}
+
+	// ignore noise
+	if (pulse < 100)
+		return 0;
+
+	// check for sync LOW pulses on rising edge
+	if (state == 1 && w->sync - w->tolerance < pulse && pulse < w->sync + w->tolerance) {
+		d->code = 0;
+		d->bits = proto->bits;
+		d->symbol = 0;
+	}
+	return 0;
+}
+
+//
+// rc3 pattern
+//
+// similar to rc2 but with longer sync
+// looks like a clock pulse with more than one data pulses follow
+// encoding not yet known, simply count the data bits after clock bit
+//
+static int decode_rc3(flamingo_decoder_t *d, uint32_t pulse, int state, uint32_t ts, flamingo_frame_t *f) {
+	// measure LOW pulses and decide if it was a data bit or a clock bit
+	if (d->bits && state == 1) {
+		if (pulse < T3Y) {
+			// simply count the data bits
+			d->databits++;
+			return 0;
+		}
+
+		// next clock bit, store data bits
+		d->multibit[32 - d->bits] = '0' + (d->databits < 9 ? d->databits : 9);
+		d->databits = 0;
+		if (--d->bits == 0) {
+			frame(d, f, FLAMINGO_RC3, ts);
+			return 1;
+		}
+		return 0;
+	}
+
+	// ignore noise
+	if (pulse < 100)
+		return 0;
+
+	// check for sync LOW pulses on rising edge
+	if (state == 1 && T3SMIN < pulse && pulse < T3SMAX) {
+		d->code = 0;
+		d->bits = 32;
+		d->databits = 0;
+		memset(d->multibit, 0, sizeof(d->multibit));
+	}
 	return 0;
 }
 
+static void tables_init() {
+	codebook_init();
+	calibration_load();
+}
+
+void flamingo_receiver_init(flamingo_receiver_t *r) {
+	static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+	// decoders and frame validation work without flamingo_init(), e.g. for replaying recordings
+	pthread_once(&once, &tables_init);
+
+	memset(r, 0, sizeof(*r));
+	r->decoders[0].protocol = FLAMINGO_RC1;
+	r->decoders[1].protocol = FLAMINGO_RC2;
+	r->decoders[2].protocol = FLAMINGO_RC3;
+	r->decoders[3].protocol = FLAMINGO_RC4;
+	r->decoders[4].protocol = FLAMINGO_SF500;
+}
+
+// feed one edge into all decoders, returns the number of frames completed with this edge
+int flamingo_receive_edge(flamingo_receiver_t *r, uint32_t ts, int level, flamingo_frame_t *frames) {
+	uint32_t pulse = ts - r->last;
+	int n = 0;
+
+	r->last = ts;
+	for (flamingo_decoder_t *d = r->decoders; d < r->decoders + FLAMINGO_DECODERS; d++) {
+		switch (d->protocol) {
+		case FLAMINGO_RC1:
+			n += decode(d, &PROTOCOLS[FLAMINGO_RC1], &windows[FLAMINGO_RC1], pulse, level, ts, &frames[n]);
+			break;
+		case FLAMINGO_RC2:
+			n += decode(d, &PROTOCOLS[FLAMINGO_RC2], &windows[FLAMINGO_RC2], pulse, level, ts, &frames[n]);
+			break;
+		case FLAMINGO_RC4:
+			n += decode(d, &PROTOCOLS[FLAMINGO_RC4], &windows[FLAMINGO_RC4], pulse, level, ts, &frames[n]);
+			break;
+		case FLAMINGO_SF500:
+			n += decode(d, &PROTOCOLS[FLAMINGO_SF500], &windows[FLAMINGO_SF500], pulse, level, ts, &frames[n]);
+			break;
+		case FLAMINGO_RC3:
+			n += decode_rc3(d, pulse, level, ts, &frames[n]);
+			break;
+		}
+	}
+	return n;
+}
+
+// decode a received frame, returns 1 if the transmitter is one of our known remotes
+int flamingo_frame_decode(flamingo_frame_t *f) {
+	const codebook_entry_t *e;
+
+	switch (f->protocol) {
+	case FLAMINGO_RC1:
+		// known codes need no decryption
+		e = codebook_lookup(f->code);
+		f->message = e ? e->message : flamingo_decrypt(f->code);
+		flamingo28_decode(f);
+		if (e)
+			return 1;
+		break;
+	case FLAMINGO_RC2:
+		f->message = f->code;
+		flamingo32_decode(f);
+		break;
+	case FLAMINGO_SF500:
+		f->message = f->code;
+		sf500_decode(f);
+		break;
+	default:
+		// rc3 + rc4 encoding unknown
+		f->message = f->code;
+		return 0;
+	}
+
+	return known_xmitter(f->xmitter);
+}
+
+static void queue_put(const flamingo_frame_t *f) {
+	uint64_t one = 1;
+
+	pthread_mutex_lock(&queue_lock);
+	if (queue_count == RX_QUEUE) {
+		queue_head = (queue_head + 1) % RX_QUEUE;
+		queue_count--;
+		stats.overwritten++;
+	}
+	queue[(queue_head + queue_count) % RX_QUEUE] = *f;
+	queue_count++;
+	pthread_mutex_unlock(&queue_lock);
+
+	write(queue_efd, &one, sizeof(one));
+}
+
+static int queue_get(flamingo_frame_t *f) {
+	int ok = 0;
+
+	pthread_mutex_lock(&queue_lock);
+	if (queue_count) {
+		*f = queue[queue_head];
+		queue_head = (queue_head + 1) % RX_QUEUE;
+		queue_count--;
+		ok = 1;
+	}
+	pthread_mutex_unlock(&queue_lock);
+	return ok;
+}
+
+// edges seen by our own receiver while we are transmitting
+static int own_edge(uint32_t ts) {
+	if (__atomic_load_n(&tx_on, __ATOMIC_ACQUIRE))
+		return 1;
+	uint32_t from = __atomic_load_n(&tx_from, __ATOMIC_RELAXED);
+	uint32_t until = __atomic_load_n(&tx_until, __ATOMIC_RELAXED);
+	return (int32_t) (ts - from) >= 0 && (int32_t) (until - ts) >= 0;
+}
+
+// a decoder in the middle of a frame, plain noise on the receiver output never gets past the sync
+static int receiving(const flamingo_receiver_t *r) {
+	for (const flamingo_decoder_t *d = r->decoders; d < r->decoders + FLAMINGO_DECODERS; d++)
+		if (d->bits)
+			return 1;
+	return 0;
+}
+
+// rc1 and rc2 frames of one button press carry the same transmitter, channel and command
+static uint32_t dedup_key(const flamingo_frame_t *f) {
+	return f->xmitter << 16 | f->channel << 8 | (f->command ? 1 : 0);
+}
+
+// only for valid frames, so noise on one receiver can't claim the slot of a press another receiver got right
+// returns 1 for the first frame of a press, 0 for its repeats and for the copies other receivers got
+static int dedup_first(const flamingo_frame_t *f) {
+	uint32_t key = dedup_key(f);
+	dedup_t *oldest = dedup;
+
+	if (!dedup_window)
+		return 1;
+
+	pthread_mutex_lock(&dedup_lock);
+	for (dedup_t *d = dedup; d < dedup + DEDUP_SLOTS; d++) {
+		if (d->count && d->key == key) {
+			// copies from another receiver may arrive slightly out of order
+			int32_t age = f->ts - d->ts;
+			int repeat = age < dedup_window * 1000 && age > -dedup_window * 1000;
+			if (age > 0)
+				d->ts = f->ts;
+			if (repeat) {
+				d->count++;
+				stats.repeats++;
+			} else
+				d->count = 1;
+			pthread_mutex_unlock(&dedup_lock);
+			return !repeat;
+		}
+		if (f->ts - d->ts > f->ts - oldest->ts || !d->count)
+			oldest = d;
+	}
+
+	oldest->key = key;
+	oldest->ts = f->ts;
+	oldest->count = 1;
+	pthread_mutex_unlock(&dedup_lock);
+	return 1;
+}
+
+// decoder thread per receiver, woken up by its edge capture
+static void* flamingo_rx(void *arg) {
+	flamingo_frame_t frames[FLAMINGO_DECODERS];
+	rx_t *rx = (rx_t*) arg;
+	gpio_edge_t e;
+
+	if (pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL)) {
+		xlog("Error setting pthread_setcancelstate");
+		return (void*) 0;
+	}
+
+	while (1) {
+		if (gpio_ring_wait(rx->ring) < 0) {
+			xlog("flamingo receiver on %s stopped: %s", rx->pin, strerror(errno));
+			return (void*) 0;
+		}
+
+		while (gpio_ring_pop(rx->ring, &e)) {
+			if (recorder && rx->index == 0)
+				gpio_record_edge(recorder, &e);
+			int n = flamingo_receive_edge(&rx->receiver, e.ts, e.level, frames);
+			if ((n || receiving(&rx->receiver)) && !own_edge(e.ts))
+				__atomic_store_n(&rx_busy, e.ts + lbt_window * 1000, __ATOMIC_RELEASE);
+			for (int i = 0; i < n; i++) {
+				flamingo_frame_t *f = &frames[i];
+				f->receiver = rx->index;
+				f->valid = flamingo_frame_decode(f);
+
+				// rc3 and rc4 encodings are unknown, their frames reach the handler unvalidated and uncombined
+				if (f->protocol == FLAMINGO_RC3 || f->protocol == FLAMINGO_RC4) {
+					queue_put(f);
+					continue;
+				}
+
+				// codes not from our remotes never reach the handler unless asked for
+				if (!f->valid) {
+					__atomic_add_fetch(&stats.unknown, 1, __ATOMIC_RELAXED);
+					if (promiscuous)
+						queue_put(f);
+					continue;
+				}
+
+				__atomic_add_fetch(&stats.received[rx->index], 1, __ATOMIC_RELAXED);
+				if (dedup_first(f))
+					queue_put(f);
+			}
+		}
+
+		uint32_t dropped = 0;
+		for (int i = 0; i < nreceivers; i++)
+			dropped += receivers[i].ring->dropped;
+		stats.dropped = dropped;
+	}
+	return (void*) 0;
+}
+
+// handler thread, woken up by the decoder thread for each queued frame
+static void* flamingo_dispatch(void *arg) {
+	flamingo_frame_t f;
+	uint64_t count;
+
+	if (pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL)) {
+		xlog("Error setting pthread_setcancelstate");
+		return (void*) 0;
+	}
+
+	while (1) {
+		if (read(queue_efd, &count, sizeof(count)) != sizeof(count))
+			continue;
+
+		while (queue_get(&f)) {
+			stats.frames++;
+			(handler)(&f);
+		}
+	}
+	return (void*) 0;
+}
+
+// record all edges received on RX to a file for replay, call before flamingo_init(), stopped by flamingo_close()
+int flamingo_record(const char *path) {
+	recorder = gpio_record_start(path);
+	return recorder ? 0 : -1;
+}
+
+// also deliver unknown codes and encodings to the handler, call before flamingo_init()
+void flamingo_promiscuous(int on) {
+	promiscuous = on;
+}
+
+// repeat folding window in ms, 0 delivers every repeat to the handler
+void flamingo_dedup(int window) {
+	dedup_window = window;
+}
+
+// carrier sense window in ms, 0 disables listen before talk
+void flamingo_lbt(int window) {
+	lbt_window = window;
+}
+
+// band busy with a foreign frame, only known when receiving
+static int busy() {
+	if (!lbt_window || !nreceivers)
+		return 0;
+	return (int32_t) (__atomic_load_n(&rx_busy, __ATOMIC_ACQUIRE) - mono_micros()) > 0;
+}
+
+const flamingo_stats_t* flamingo_stats() {
+	return &stats;
+}
+
 #ifdef FLAMINGO_MAIN
+// pulse classes the decoders distinguish, tolerance is the distance to the decoder's decision threshold
+typedef struct pulse_class_t {
+	const char *name;
+	int protocol;
+	int level;
+	uint32_t us;
+	uint32_t tolerance;
+	uint32_t count;
+	int64_t sum;
+	int32_t min;
+	int32_t max;
+} pulse_class_t;
+
+static pulse_class_t classes[] = {
+	{ "rc1 sync low", FLAMINGO_RC1, 0 },
+	{ "rc1 short high", FLAMINGO_RC1, 1 },
+	{ "rc1 long high", FLAMINGO_RC1, 1 },
+	{ "rc2 sync low", FLAMINGO_RC2, 0 },
+	{ "rc2 short low", FLAMINGO_RC2, 0 },
+	{ "rc2 long low", FLAMINGO_RC2, 0 },
+};
+
+// nominal lengths and tolerances from the protocol descriptors
+static void selftest_classes() {
+	for (pulse_class_t *c = classes; c < classes + ARRAY_SIZE(classes); c += 3) {
+		const gpio_protocol_t *proto = &PROTOCOLS[c->protocol];
+		const window_t *w = &windows[c->protocol];
+		int i = proto->level ? 0 : 1;
+		c[0].us = proto->sync[1];
+		c[0].tolerance = w->tolerance;
+		c[1].us = proto->zero[i];
+		c[1].tolerance = w->threshold - proto->zero[i];
+		c[2].us = proto->one[i];
+		c[2].tolerance = proto->one[i] - w->threshold;
+	}
+}
+
+// offset of the played program in the captured edges, noise edges before or after the frame are skipped, -1 if not found
+static int selftest_align(const gpio_program_t *p, const gpio_edge_t *edges, int n) {
+	uint32_t best_err = UINT32_MAX;
+	int best = -1;
+
+	for (int o = 0; o + p->count <= n; o++) {
+		uint32_t err = 0;
+		int i;
+		for (i = 0; i < p->count - 1 && edges[o + i].level == p->pulses[i].level; i++)
+			err += abs((int32_t) (edges[o + i + 1].ts - edges[o + i].ts) - (int32_t) p->pulses[i].us);
+		if (i == p->count - 1 && err < best_err) {
+			best_err = err;
+			best = o;
+		}
+	}
+	return best;
+}
+
+// compare the captured edges with the played program pulse by pulse
+static void selftest_timing(int protocol, const gpio_program_t *p, const gpio_edge_t *edges, int n) {
+	int o = selftest_align(p, edges, n);
+	if (o < 0)
+		return;
+
+	edges += o;
+	for (int i = 0; i < p->count - 1; i++) {
+		int32_t dev = (int32_t) (edges[i + 1].ts - edges[i].ts) - p->pulses[i].us;
+		for (pulse_class_t *c = classes; c < classes + ARRAY_SIZE(classes); c++) {
+			if (c->protocol != protocol || c->level != p->pulses[i].level || c->us != p->pulses[i].us)
+				continue;
+			if (!c->count || dev < c->min)
+				c->min = dev;
+			if (!c->count || dev > c->max)
+				c->max = dev;
+			c->sum += dev;
+			c->count++;
+		}
+	}
+}
+
+// play a program on TX, collect its edges on RX and count the repeats the decoders got right
+static int selftest_frame(int protocol, uint32_t code, const gpio_program_t *p, gpio_ring_t *ring, flamingo_receiver_t *r) {
+	flamingo_frame_t frames[FLAMINGO_DECODERS];
+	static gpio_edge_t edges[GPIO_RING_SIZE];
+	int n = 0, ok = 0;
+
+	while (gpio_ring_pop(ring, &edges[0]))
+		;
+
+	gpio_play(&tx, p);
+	msleep(20);
+
+	while (n < GPIO_RING_SIZE && gpio_ring_pop(ring, &edges[n]))
+		n++;
+
+	flamingo_receiver_init(r);
+	for (int i = 0; i < n; i++) {
+		int k = flamingo_receive_edge(r, edges[i].ts, edges[i].level, frames);
+		for (int j = 0; j < k; j++)
+			if (frames[j].protocol == protocol && frames[j].code == code)
+				ok++;
+	}
+
+	selftest_timing(protocol, p, edges, n);
+	return ok;
+}
+
+// TX to RX loopback: send random frames of our remotes, decode what comes back and report the timing margins
+static int selftest(int count) {
+	flamingo_receiver_t r;
+	gpio_program_t p;
+	gpio_capture_t *capture;
+	gpio_ring_t *ring;
+	int rc1 = 0, rc2 = 0, rc1_repeats = 0, rc2_repeats = 0, ret = EXIT_FAILURE;
+
+	if (flamingo_init(NULL) < 0)
+		return EXIT_FAILURE;
+
+	ring = malloc(sizeof(*ring));
+	gpio_ring_init(ring);
+	capture = gpio_capture_start(RX, ring);
+	if (capture == NULL) {
+		printf("no capture on %s\n", RX);
+		goto out;
+	}
+
+	selftest_classes();
+	srand(time(NULL));
+	for (int i = 0; i < count; i++) {
+		int remote = rand() % ARRAY_SIZE(REMOTES);
+		int channel = rand() % 4;
+		int command = rand() % 2;
+		int rolling = rand() % 4;
+
+		uint32_t c28 = codebook[remote][channel][command][rolling];
+		gpio_protocol_compile(&p, &PROTOCOLS[FLAMINGO_RC1], c28);
+		int ok = selftest_frame(FLAMINGO_RC1, c28, &p, ring, &r);
+		rc1_repeats += ok;
+		rc1 += ok ? 1 : 0;
+
+		uint32_t m32 = flamingo32_encode(REMOTES[remote], channel + 1, command, 0);
+		gpio_protocol_compile(&p, &PROTOCOLS[FLAMINGO_RC2], m32);
+		ok = selftest_frame(FLAMINGO_RC2, m32, &p, ring, &r);
+		rc2_repeats += ok;
+		rc2 += ok ? 1 : 0;
+	}
+
+	printf("rc1 %d/%d frames %5.1f%%, %d/%d repeats decoded\n", rc1, count, rc1 * 100.0 / count, rc1_repeats, count * PROTOCOLS[FLAMINGO_RC1].repeat);
+	printf("rc2 %d/%d frames %5.1f%%, %d/%d repeats decoded\n", rc2, count, rc2 * 100.0 / count, rc2_repeats, count * PROTOCOLS[FLAMINGO_RC2].repeat);
+	printf("%-16s %7s %7s %7s %7s %7s %9s %7s\n", "pulse", "nominal", "count", "avg", "min", "max", "tolerance", "margin");
+	for (pulse_class_t *c = classes; c < classes + ARRAY_SIZE(classes); c++) {
+		if (!c->count) {
+			printf("%-16s %7u %7u\n", c->name, c->us, 0);
+			continue;
+		}
+		int32_t worst = -c->min > c->max ? -c->min : c->max;
+		printf("%-16s %7u %7u %7.1f %7d %7d %9u %7d\n", c->name, c->us, c->count, (double) c->sum / c->count, c->min, c->max, c->tolerance,
+				(int32_t) c->tolerance - worst);
+	}
+
+	gpio_capture_stop(capture);
+	ret = rc1 == count && rc2 == count ? EXIT_SUCCESS : EXIT_FAILURE;
+
+out:
+	gpio_ring_close(ring);
+	free(ring);
+	flamingo_close();
+	return ret;
+}
+
+// samples of one protocol sent by one remote
+#define LEARN_GROUPS		16
+#define LEARN_SAMPLES		65536
+#define LEARN_EDGES			(1024 * 1024)
+
+typedef struct learn_group_t {
+	uint16_t xmitter;
+	int protocol;
+	int frames;
+	int count[2];
+	uint32_t *samples[2];					// pulse lengths per level
+} learn_group_t;
+
+static learn_group_t groups[LEARN_GROUPS];
+static int ngroups;
+
+static learn_group_t* learn_group(uint16_t xmitter, int protocol) {
+	for (learn_group_t *g = groups; g < groups + ngroups; g++)
+		if (g->xmitter == xmitter && g->protocol == protocol)
+			return g;
+
+	if (ngroups == LEARN_GROUPS)
+		return NULL;
+
+	learn_group_t *g = &groups[ngroups++];
+	g->xmitter = xmitter;
+	g->protocol = protocol;
+	g->samples[0] = malloc(LEARN_SAMPLES * sizeof(uint32_t));
+	g->samples[1] = malloc(LEARN_SAMPLES * sizeof(uint32_t));
+	return g;
+}
+
+// 1-D k-means, centroids start at the nominal lengths
+static void kmeans(const uint32_t *x, int n, int k, double *c, double *sd, int *count) {
+	double sum[GPIO_SYMBOL_SIZE + 2], sq[GPIO_SYMBOL_SIZE + 2];
+
+	for (int iter = 0; iter < 20; iter++) {
+		memset(sum, 0, sizeof(sum));
+		memset(sq, 0, sizeof(sq));
+		memset(count, 0, k * sizeof(int));
+		for (int i = 0; i < n; i++) {
+			int best = 0;
+			for (int j = 1; j < k; j++)
+				if (fabs(x[i] - c[j]) < fabs(x[i] - c[best]))
+					best = j;
+			sum[best] += x[i];
+			sq[best] += (double) x[i] * x[i];
+			count[best]++;
+		}
+		for (int j = 0; j < k; j++)
+			if (count[j])
+				c[j] = sum[j] / count[j];
+	}
+	for (int j = 0; j < k; j++)
+		sd[j] = count[j] ? sqrt(sq[j] / count[j] - c[j] * c[j]) : 0;
+}
+
+// distinct pulse lengths of a level in a descriptor
+static int nominals(const gpio_protocol_t *proto, int level, uint16_t *us) {
+	uint16_t all[GPIO_SYMBOL_SIZE * 2 + 2];
+	int n = 0, k = 0;
+
+	all[n++] = proto->sync[!level];
+	all[n++] = proto->tail[!level];
+	for (int i = !level; i < GPIO_SYMBOL_SIZE; i += 2) {
+		all[n++] = proto->zero[i];
+		all[n++] = proto->one[i];
+	}
+
+	for (int i = 0; i < n; i++) {
+		int dup = !all[i];
+		for (int j = 0; j < k; j++)
+			dup |= us[j] == all[i];
+		if (!dup)
+			us[k++] = all[i];
+	}
+	return k;
+}
+
+static void learn_store(calibration_t *c) {
+	for (calibration_t *o = calibrations; o < calibrations + ncalibrations; o++)
+		if (o->xmitter == c->xmitter && o->protocol == c->protocol && o->level == c->level && o->nominal == c->nominal) {
+			*o = *c;
+			return;
+		}
+	if (ncalibrations < CALIBRATIONS)
+		calibrations[ncalibrations++] = *c;
+}
+
+// cluster the pulses of all decoded frames per remote, protocol and level and store centroids and tolerance windows
+static int learn(int seconds) {
+	flamingo_frame_t frames[FLAMINGO_DECODERS];
+	flamingo_receiver_t r;
+	gpio_capture_t *capture;
+	gpio_ring_t *ring;
+	gpio_edge_t *edges = NULL;
+	int n = 0, ret = EXIT_FAILURE;
+
+	if (flamingo_init(NULL) < 0)
+		return EXIT_FAILURE;
+
+	ring = malloc(sizeof(*ring));
+	gpio_ring_init(ring);
+	capture = gpio_capture_start(RX, ring);
+	if (capture == NULL) {
+		printf("no capture on %s\n", RX);
+		goto out;
+	}
+
+	printf("press the buttons of one remote for %d seconds ...\n", seconds);
+	edges = malloc(LEARN_EDGES * sizeof(gpio_edge_t));
+	for (int i = 0; i < seconds * 100 && n < LEARN_EDGES; i++) {
+		msleep(10);
+		while (n < LEARN_EDGES && gpio_ring_pop(ring, &edges[n]))
+			n++;
+	}
+	gpio_capture_stop(capture);
+
+	// frames found with wide sync windows tell which pulses belong to a transmission and to which remote
+	for (int p = 1; p < PROTOCOLS_MAX; p++)
+		windows[p].tolerance = windows[p].sync / 8;
+	flamingo_receiver_init(&r);
+	for (int i = 1; i < n; i++) {
+		int k = flamingo_receive_edge(&r, edges[i].ts, edges[i].level, frames);
+		for (int j = 0; j < k; j++) {
+			flamingo_frame_t *f = &frames[j];
+			if (f->protocol == FLAMINGO_RC3 || !flamingo_frame_decode(f))
+				continue;
+
+			// sync + all bits up to the pulse deciding the last one
+			const gpio_protocol_t *proto = &PROTOCOLS[f->protocol];
+			int len = 0;
+			while (len < GPIO_SYMBOL_SIZE && proto->zero[len])
+				len++;
+			int pulses = 2 + (proto->bits - 1) * len + (proto->level ? 1 : 2);
+			if (i < pulses)
+				continue;
+
+			learn_group_t *g = learn_group(f->xmitter, f->protocol);
+			if (g == NULL)
+				continue;
+			g->frames++;
+			for (int e = i - pulses; e < i; e++) {
+				int level = edges[e].level;
+				if (g->count[level] < LEARN_SAMPLES)
+					g->samples[level][g->count[level]++] = edges[e + 1].ts - edges[e].ts;
+			}
+		}
+	}
+
+	calibration_load();
+	for (learn_group_t *g = groups; g < groups + ngroups; g++) {
+		printf("xmitter 0x%04x rc%d %d frames\n", g->xmitter, g->protocol, g->frames);
+		for (int level = 1; level >= 0; level--) {
+			double c[GPIO_SYMBOL_SIZE + 2], sd[GPIO_SYMBOL_SIZE + 2];
+			int count[GPIO_SYMBOL_SIZE + 2];
+			uint16_t us[GPIO_SYMBOL_SIZE + 2];
+
+			int k = nominals(&PROTOCOLS[g->protocol], level, us);
+			for (int j = 0; j < k; j++)
+				c[j] = us[j];
+			kmeans(g->samples[level], g->count[level], k, c, sd, count);
+
+			for (int j = 0; j < k; j++) {
+				// 4 sigma window, at least the jitter of our own player, at most what keeps rc2 and SF-500R syncs apart
+				uint16_t tolerance = 4 * sd[j] < CAL_TOLERANCE_MIN ? CAL_TOLERANCE_MIN : 4 * sd[j] > CAL_TOLERANCE_MAX ? CAL_TOLERANCE_MAX : 4 * sd[j];
+				printf("  %s %5u us -> %7.1f us sd %5.1f n %6d tolerance %u\n", level ? "high" : "low ", us[j], c[j], sd[j], count[j], tolerance);
+				if (!count[j])
+					continue;
+
+				calibration_t cal = { g->xmitter, g->protocol, level, us[j], (uint16_t) (c[j] + 0.5), tolerance };
+				learn_store(&cal);
+			}
+		}
+	}
+
+	FILE *f = fopen(FLAMINGO_CALIBRATION, "w");
+	if (f == NULL) {
+		printf("%s: %s\n", FLAMINGO_CALIBRATION, strerror(errno));
+		goto out;
+	}
+	fprintf(f, "# xmitter protocol level nominal measured tolerance\n");
+	for (calibration_t *c = calibrations; c < calibrations + ncalibrations; c++)
+		fprintf(f, "%04x %d %d %u %u %u\n", c->xmitter, c->protocol, c->level, c->nominal, c->measured, c->tolerance);
+	fclose(f);
+	printf("%d edges, %d remote protocols learned, written to %s\n", n, ngroups, FLAMINGO_CALIBRATION);
+	ret = ngroups ? EXIT_SUCCESS : EXIT_FAILURE;
+
+out:
+	gpio_ring_close(ring);
+	free(ring);
+	free(edges);
+	flamingo_close();
+	return ret;
+}
+
 static int usage() {
-	printf("Usage: flamingo <remote> <channel> <command> [rolling]\n");
+	printf("Usage: flamingo -r [file] | -t [count] | -l [seconds] | <remote> <channel> <command> [rolling]\n");
+	printf("    -r        receive and print all rc1, rc2, rc3, rc4 and SF-500R codes, record edges to file for flamingo-replay\n");
+	printf("    -t        TX to RX loopback self test with count frames, default 100\n");
+	printf("    -l        learn pulse timings of a remote for seconds, default 30\n");
 	printf("    <remote>  1, 2, 3, ...\n");
 	printf("    <channel> A, B, C, D\n");
 	printf("    <command> 0 - off, 1 - on\n");
@@ -83,10 +1169,90 @@ static int usage() {
 	return EXIT_FAILURE;
 }
 
+// seconds to wait for the answer of a running mcp
+#define MCP_TIMEOUT			5
+
+// submit to a running mcp, returns -1 when there is none
+static int send_mcp(int remote, char channel, int command, int rolling) {
+	struct sockaddr_un addr;
+	char buf[64];
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		return -1;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, FLAMINGO_SOCKET, sizeof(addr.sun_path) - 1);
+	if (connect(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	// mcp answers as soon as the command is queued, a stuck daemon must not hang the command line
+	struct timeval tv = { MCP_TIMEOUT, 0 };
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+	int n = snprintf(buf, sizeof(buf), "flamingo %d %c %d %d\n", remote, channel, command, rolling);
+	if (send(fd, buf, n, MSG_NOSIGNAL) != n) {
+		close(fd);
+		return -1;
+	}
+
+	n = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (n <= 0) {
+		printf("no answer from mcp\n");
+		return EXIT_FAILURE;
+	}
+
+	buf[n] = '\0';
+	if (strncmp(buf, "ok", 2)) {
+		printf("mcp: %s", buf);
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+// let pause() return so that recordings get closed
+static void sig_handler(int signo) {
+}
+
+static void print_handler(const flamingo_frame_t *f) {
+	if (f->protocol == FLAMINGO_RC3) {
+		printf("rc%d %s\n", f->protocol, f->multibit);
+		return;
+	}
+
+	printf("rc%d 0x%08x => 0x%08x xmitter = 0x%04x channel = %d command = %d payload = 0x%02x rolling = %d%s\n", f->protocol, f->code, f->message,
+			f->xmitter, f->channel, f->command, f->payload, f->rolling, f->valid ? "" : " (unknown)");
+}
+
 static int flamingo_main(int argc, char **argv) {
 	if (argc < 1)
 		return usage();
 
+	if (argc >= 2 && !strcmp(argv[1], "-r")) {
+
+		// RECEIVE mode, optionally recording the edges
+		if (argc > 2 && flamingo_record(argv[2]) < 0)
+			return EXIT_FAILURE;
+		flamingo_promiscuous(1);
+		if (flamingo_init(&print_handler) < 0)
+			return EXIT_FAILURE;
+		signal(SIGINT, sig_handler);
+		signal(SIGTERM, sig_handler);
+		pause();
+		flamingo_close();
+		return EXIT_SUCCESS;
+	}
+
+	if (argc >= 2 && !strcmp(argv[1], "-t"))
+		return selftest(argc > 2 ? atoi(argv[2]) : 100);
+
+	if (argc >= 2 && !strcmp(argv[1], "-l"))
+		return learn(argc > 2 ? atoi(argv[2]) : 30);
+
 	if (argc >= 4) {
 
 		// SEND mode
@@ -127,68 +1293,433 @@ static int flamingo_main(int argc, char **argv) {
 			}
 		}
 
-		// initialize without receive support (clear pattern + default handler)
-		flamingo_init();
-		flamingo_send_FA500(remote, channel, command, rolling);
+		// mcp owns the transmitter when running
+		int ret = send_mcp(remote, channel, command, rolling);
+		if (ret >= 0)
+			return ret;
+
+		// initialize without receive support
+		if (flamingo_init(NULL) < 0)
+			return EXIT_FAILURE;
+		int result = flamingo_send_FA500(remote, channel, command, rolling);
 		flamingo_close();
-		return EXIT_SUCCESS;
+		return result == FLAMINGO_SENT ? EXIT_SUCCESS : EXIT_FAILURE;
 
 	} else
 		return usage();
 }
 #endif
 
-void flamingo_send_FA500(int remote, char channel, int command, int rolling) {
+// one rolling code followed by the rc2 message
+static int compile_FA500(gpio_program_t *p1, gpio_program_t *p2, int remote, char channel, int command, int rolling) {
+	uint32_t c28 = codebook[remote - 1][channel - 'A'][command ? 1 : 0][rolling];
+	uint32_t m32 = flamingo32_encode(REMOTES[remote - 1], channel - 'A' + 1, command, 0);
+
+	int err = gpio_protocol_compile(p1, &tx_protocols[remote - 1][FLAMINGO_RC1], c28);
+	err |= gpio_protocol_compile(p2, &tx_protocols[remote - 1][FLAMINGO_RC2], m32);
+	return err;
+}
+
+
+// wait on the transmit condition until woken up or the absolute ms time is reached, tx_lock must be held
+static void tx_wait(uint64_t until) {
+	struct timespec ts;
+
+	ts.tv_sec = until / 1000;
+	ts.tv_nsec = (until % 1000) * 1000000;
+	pthread_cond_timedwait(&tx_cond, &tx_lock, &ts);
+}
+
+static int tx_find(int id) {
+	for (int i = 0; i < tx_count; i++)
+		if (tx_queue[i].id == id)
+			return i;
+	return -1;
+}
+
+// queue the rolling code 0..3 or all rolling codes when -1 for sending on the transmit thread, returns the job id or -1
+int flamingo_submit_FA500(int remote, char channel, int command, int rolling, int prio, flamingo_done_t done, void *arg) {
+	tx_job_t old = { 0 };
+	int id;
+
 	if (remote < 1 || remote > ARRAY_SIZE(REMOTES))
-		return;
+		return -1;
 
 	if (channel < 'A' || channel > 'P')
-		return;
+		return -1;
+
+	// the rc1 codebook only knows off and on, anything else would send an rc2 frame that contradicts it
+	if (command != 0 && command != 1)
+		return -1;
 
-	uint16_t transmitter = REMOTES[remote - 1];
-	if (0 <= rolling && rolling <= 4) {
-		// send specified rolling code
-		uint32_t c28 = flamingo28_encode(transmitter, channel - 'A' + 1, command ? 2 : 0, 0, rolling);
-		gpio_flamingo_v1(TX, c28, 28, 4, T1);
+	if (rolling < -1 || rolling > 3)
+		return -1;
 
-		uint32_t m32 = flamingo32_encode(transmitter, channel - 'A' + 1, command, 0);
-		gpio_flamingo_v2(TX, m32, 32, 3, T2H, T2L);
-	} else {
-		// send all rolling codes in sequence
-		for (int r = 0; r < 4; r++) {
-			uint32_t c28 = flamingo28_encode(transmitter, channel - 'A' + 1, command ? 2 : 0, 0, r);
-			gpio_flamingo_v1(TX, c28, 28, 4, T1);
+	pthread_mutex_lock(&tx_lock);
+	if (!thread_tx || tx_stop) {
+		pthread_mutex_unlock(&tx_lock);
+		return -1;
+	}
 
-			uint32_t m32 = flamingo32_encode(transmitter, channel - 'A' + 1, command, 0);
-			gpio_flamingo_v2(TX, m32, 32, 3, T2H, T2L);
-			sleep(1);
+	// a newer command for the same socket replaces a queued or running one and keeps its priority when higher
+	for (int i = 0; i < tx_count; i++)
+		if (tx_queue[i].remote == remote && tx_queue[i].channel == channel) {
+			old = tx_queue[i];
+			if (old.prio > prio)
+				prio = old.prio;
+			tx_queue[i] = tx_queue[--tx_count];
+			stats.superseded++;
+			break;
 		}
+
+	if (tx_count == TX_QUEUE) {
+		pthread_mutex_unlock(&tx_lock);
+		xlog("flamingo transmit queue full");
+		return -1;
 	}
+
+	id = ++tx_seq;
+	tx_job_t *j = &tx_queue[tx_count++];
+	memset(j, 0, sizeof(*j));
+	j->id = id;
+	j->prio = prio;
+	j->remote = remote;
+	j->channel = channel;
+	j->command = command;
+	j->done = done;
+	j->arg = arg;
+	j->rolling = rolling < 0 ? 0 : rolling;
+	j->last = rolling < 0 ? 3 : rolling;
+	pthread_cond_broadcast(&tx_cond);
+	pthread_mutex_unlock(&tx_lock);
+
+	if (old.id && old.done)
+		(old.done)(old.id, FLAMINGO_SUPERSEDED, old.arg);
+
+	return id;
 }
 
-// TODO
-void flamingo_send_SF500(int remote, char channel, int command) {
-	if (remote < 1 || remote > ARRAY_SIZE(REMOTES))
-		return;
+// highest priority due job, longest overdue first within same priority so that no job starves in the others' gaps,
+// otherwise the time when the next one gets due
+static int tx_next(uint64_t now, uint64_t *next) {
+	int best = -1;
 
-	uint16_t transmitter = REMOTES[remote - 1];
-	uint32_t message = flamingo24_encode(transmitter, channel - 'A' + 1, command, 0);
-	gpio_flamingo_v2(TX, message, 32, 5, T2H, T2L);
+	*next = UINT64_MAX;
+	for (int i = 0; i < tx_count; i++) {
+		tx_job_t *j = &tx_queue[i];
+		if (j->due > now) {
+			if (j->due < *next)
+				*next = j->due;
+			continue;
+		}
+		tx_job_t *b = &tx_queue[best < 0 ? i : best];
+		if (best < 0 || j->prio > b->prio || (j->prio == b->prio && (j->due < b->due || (j->due == b->due && j->id < b->id))))
+			best = i;
+	}
+	return best;
 }
 
-int flamingo_init() {
+// token bucket refilled with TX_DUTY percent of the elapsed time, returns the ms to wait until airtime is available
+static uint64_t tx_budget(uint64_t now, uint32_t airtime) {
+	tx_tokens += (now - tx_refill) * 1000 * TX_DUTY / 100;
+	if (tx_tokens > TX_BUCKET)
+		tx_tokens = TX_BUCKET;
+	tx_refill = now;
+
+	if (tx_tokens >= airtime)
+		return 0;
+	return (airtime - tx_tokens) * 100 / TX_DUTY / 1000 + 1;
+}
+
+// transmit thread, interleaves the rolling codes of all jobs into each other's gaps within the duty cycle limit
+static void* flamingo_tx(void *arg) {
+	gpio_program_t p1, p2;
+	tx_job_t job;
+	uint64_t now, next;
+
+	srand(time(NULL));
+	pthread_mutex_lock(&tx_lock);
+	tx_tokens = TX_BUCKET;
+	tx_refill = mono_millis();
+	while (!tx_stop) {
+		now = mono_millis();
+		int i = tx_next(now, &next);
+		if (i < 0) {
+			if (next == UINT64_MAX)
+				pthread_cond_wait(&tx_cond, &tx_lock);
+			else
+				tx_wait(next);
+			continue;
+		}
+		job = tx_queue[i];
+		pthread_mutex_unlock(&tx_lock);
+
+		int err = compile_FA500(&p1, &p2, job.remote, job.channel, job.command, job.rolling);
+
+		pthread_mutex_lock(&tx_lock);
+
+		// superseded while compiling, the replacement is queued under a new id
+		i = tx_find(job.id);
+		if (i < 0)
+			continue;
+
+		// nothing goes on air when compiling failed, the rolling code is skipped without charging budget or airtime
+		uint32_t airtime = err ? 0 : p1.duration + p2.duration;
+		if (err == 0) {
+			uint64_t wait = tx_budget(now, airtime);
+			if (wait) {
+				// throttled, the job may get superseded meanwhile, wakeups before the budget is available are not counted again
+				if (!tx_queue[i].throttled)
+					stats.throttled++;
+				tx_queue[i].throttled = 1;
+				tx_wait(now + wait);
+				continue;
+			}
+
+			// listen before talk, give up deferring after LBT_RETRIES and risk the collision
+			if (busy()) {
+				if (tx_queue[i].backoffs < LBT_RETRIES) {
+					tx_queue[i].backoffs++;
+					tx_queue[i].due = now + lbt_window + rand() % LBT_BACKOFF;
+					stats.backoffs++;
+					continue;
+				}
+				stats.collisions++;
+			}
+			tx_tokens -= airtime;
+		}
+		pthread_mutex_unlock(&tx_lock);
+
+		if (err == 0) {
+			__atomic_store_n(&tx_from, mono_micros(), __ATOMIC_RELAXED);
+			__atomic_store_n(&tx_on, 1, __ATOMIC_RELEASE);
+			gpio_play(&tx, &p1);
+			gpio_play(&tx, &p2);
+			__atomic_store_n(&tx_until, mono_micros(), __ATOMIC_RELAXED);
+			__atomic_store_n(&tx_on, 0, __ATOMIC_RELEASE);
+		}
+
+		pthread_mutex_lock(&tx_lock);
+		stats.airtime += airtime / 1000;
+		i = tx_find(job.id);
+		if (i < 0)
+			continue;
+
+		tx_queue[i].backoffs = 0;
+		tx_queue[i].throttled = 0;
+		if (++tx_queue[i].rolling <= tx_queue[i].last) {
+			tx_queue[i].due = mono_millis() + TX_GAP;
+			continue;
+		}
+
+		tx_queue[i] = tx_queue[--tx_count];
+		stats.transmitted++;
+		if (job.done) {
+			pthread_mutex_unlock(&tx_lock);
+			(job.done)(job.id, FLAMINGO_SENT, job.arg);
+			pthread_mutex_lock(&tx_lock);
+		}
+	}
+	pthread_mutex_unlock(&tx_lock);
+	return (void*) 0;
+}
+
+// completion of a job waited for by flamingo_send_FA500()
+typedef struct tx_sync_t {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int result;
+} tx_sync_t;
+
+static void tx_sync_done(int id, int result, void *arg) {
+	tx_sync_t *sync = (tx_sync_t*) arg;
+
+	pthread_mutex_lock(&sync->lock);
+	sync->result = result;
+	pthread_cond_signal(&sync->cond);
+	pthread_mutex_unlock(&sync->lock);
+}
+
+// queue the rolling code 0..3 or all rolling codes when -1 and block until the transmit thread is done with the job,
+// returns FLAMINGO_SENT, FLAMINGO_SUPERSEDED, FLAMINGO_CANCELED or -1 when rejected
+int flamingo_send_FA500(int remote, char channel, int command, int rolling) {
+	tx_sync_t sync = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, -1 };
+
+	pthread_mutex_lock(&sync.lock);
+	if (flamingo_submit_FA500(remote, channel, command, rolling, FLAMINGO_PRIO_HIGH, &tx_sync_done, &sync) < 0) {
+		pthread_mutex_unlock(&sync.lock);
+		return -1;
+	}
+	while (sync.result < 0)
+		pthread_cond_wait(&sync.cond, &sync.lock);
+	pthread_mutex_unlock(&sync.lock);
+
+	pthread_cond_destroy(&sync.cond);
+	pthread_mutex_destroy(&sync.lock);
+	return sync.result;
+}
+
+// give up the transmitter to other processes
+static void lock_release() {
+	if (lock_fd >= 0)
+		close(lock_fd);
+	lock_fd = -1;
+}
+
+int flamingo_init(flamingo_handler_t h) {
+	codebook_init();
+	calibration_load();
+
+#ifndef GPIO_SIM
 	// elevate realtime priority for sending thread
 	if (elevate_realtime(3) < 0)
 		return -2;
+#endif
+
+	// only one process may drive the transmitter
+	lock_fd = open(FLAMINGO_LOCK, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (lock_fd >= 0 && flock(lock_fd, LOCK_EX | LOCK_NB) < 0) {
+		xlog("flamingo transmitter owned by another process");
+		lock_release();
+		return -4;
+	}
+
+	// no-op when already done by mcp
+	if (gpio_init() < 0) {
+		lock_release();
+		return -1;
+	}
+
+	// GPIO pins connected to 433MHz receiver+sender modules
+	if (gpio_pin(&tx, TX) < 0) {
+		lock_release();
+		return -3;
+	}
+	gpio_pin_configure(&tx, 1, 0, 0);
+
+	for (int i = 0; i < ARRAY_SIZE(RX_PINS); i++) {
+		gpio_pin_t rx;
+		if (gpio_pin(&rx, RX_PINS[i]) < 0) {
+			lock_release();
+			return -3;
+		}
+		gpio_pin_configure(&rx, 0, 0, 0);
+	}
+
+	// transmit worker, gaps are measured on the monotonic clock
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&tx_cond, &attr);
+	pthread_condattr_destroy(&attr);
+	tx_stop = 0;
+	if (pthread_create(&thread_tx, NULL, &flamingo_tx, NULL)) {
+		xlog("Error creating thread");
+		thread_tx = 0;
+		pthread_cond_destroy(&tx_cond);
+		lock_release();
+		return -5;
+	}
 
-	// GPIO pin connected to 433MHz receiver+sender module
-	gpio_configure(RX, 0, 0, 0);
-	gpio_configure(TX, 1, 0, 0);
+	// without handler only send support
+	if (h == NULL)
+		return 0;
+
+	// capture edges on each RX pin and run all decoders on them
+	handler = h;
+	for (int i = 0; i < ARRAY_SIZE(RX_PINS); i++) {
+		rx_t *rx = &receivers[nreceivers];
+		rx->pin = RX_PINS[i];
+		rx->index = nreceivers;
+		flamingo_receiver_init(&rx->receiver);
+		rx->ring = malloc(sizeof(*rx->ring));
+		gpio_ring_init(rx->ring);
+		rx->capture = gpio_capture_start(rx->pin, rx->ring);
+		if (rx->capture == NULL) {
+			xlog("flamingo receiver on %s not available", rx->pin);
+			gpio_ring_close(rx->ring);
+			free(rx->ring);
+			rx->ring = NULL;
+			continue;
+		}
+		nreceivers++;
+	}
+	if (!nreceivers)
+		return 0;
+
+	// flamingo_close() stops what is already running and releases the lock
+	queue_efd = eventfd(0, 0);
+	if (pthread_create(&thread_dispatch, NULL, &flamingo_dispatch, NULL)) {
+		xlog("Error creating thread");
+		thread_dispatch = 0;
+		flamingo_close();
+		return -5;
+	}
+	for (rx_t *rx = receivers; rx < receivers + nreceivers; rx++)
+		if (pthread_create(&rx->thread, NULL, &flamingo_rx, rx)) {
+			xlog("Error creating thread");
+			rx->thread = 0;
+			flamingo_close();
+			return -5;
+		}
 
 	return 0;
 }
 
 void flamingo_close() {
+	if (thread_tx) {
+		pthread_mutex_lock(&tx_lock);
+		tx_stop = 1;
+		pthread_cond_broadcast(&tx_cond);
+		pthread_mutex_unlock(&tx_lock);
+		if (pthread_join(thread_tx, NULL))
+			xlog("Error joining thread");
+		thread_tx = 0;
+
+		// jobs not or not completely sent
+		while (tx_count) {
+			tx_job_t *j = &tx_queue[--tx_count];
+			if (j->done)
+				(j->done)(j->id, FLAMINGO_CANCELED, j->arg);
+		}
+		pthread_cond_destroy(&tx_cond);
+	}
+
+	for (rx_t *rx = receivers; rx < receivers + nreceivers; rx++) {
+		if (!rx->thread)
+			continue;
+		if (pthread_cancel(rx->thread))
+			xlog("Error canceling thread");
+		if (pthread_join(rx->thread, NULL))
+			xlog("Error joining thread");
+		rx->thread = 0;
+	}
+
+	if (thread_dispatch) {
+		if (pthread_cancel(thread_dispatch))
+			xlog("Error canceling thread");
+		if (pthread_join(thread_dispatch, NULL))
+			xlog("Error joining thread");
+		thread_dispatch = 0;
+	}
+
+	for (rx_t *rx = receivers; rx < receivers + nreceivers; rx++) {
+		gpio_capture_stop(rx->capture);
+		rx->capture = NULL;
+		gpio_ring_close(rx->ring);
+		free(rx->ring);
+		rx->ring = NULL;
+	}
+	nreceivers = 0;
+
+	gpio_record_stop(recorder);
+	recorder = NULL;
+
+	if (queue_efd >= 0)
+		close(queue_efd);
+	queue_efd = -1;
+
+	lock_release();
 }
 
 #ifdef FLAMINGO_MAIN
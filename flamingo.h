@@ -5,11 +5,19 @@
 // picam
 #define TX				"GPIO04"
 #define RX				"GPIO17"
+// #define RX2				"GPIO27"			// second receiver module for diversity reception
 
 // pidev
 // #define TX					"GPIO17"
 // #define RX					"GPIO27"
 
+// mcp control socket accepting send and stats commands, lock held by the process owning the transmitter
+#define FLAMINGO_SOCKET		"/run/flamingo.sock"
+#define FLAMINGO_LOCK		"/run/flamingo.lock"
+
+// pulse timings learned with flamingo -l
+#define FLAMINGO_CALIBRATION	"/etc/flamingo.cal"
+
 #define SPACEMASK_FA500		0x01000110
 #define SPACEMASK_SF500		0x00010110
 
@@ -17,47 +25,121 @@
 const static uint16_t REMOTES[5] = { 0x53cc, 0x835a, 0x31e2, 0x295c, 0x272d };
 //									 White1  White2  White3  Black   SF500
 
-// timings for 28bit rc1 and 24bit rc4 patterns
+// base timings, the protocol descriptors in flamingo.c derive all pulses and tolerances from them
+
+// 28bit rc1 and 24bit rc4 patterns
 // tested with 1 C 1: min 180 max 350 --> 330 is closest to the original remote
 #define T1					330
-const static uint16_t T1X2 = T1 * 2;
-const static uint16_t T1X3 = T1 * 3;
-const static uint16_t T1X15 = T1 * 15;
-const static uint16_t T1X31 = T1 * 31;
-const static uint16_t T1SMIN = T1X15 - 80;
-const static uint16_t T1SMAX = T1X15 + 80;
-const static uint16_t T4SMIN = T1X31 - 100;
-const static uint16_t T4SMAX = T1X31 + 100;
-
-// timings for 32bit rc2 patterns
+
+// 32bit rc2 patterns
 #define T2H					200
 #define T2L					330
-const static uint16_t T2X = (T2H + T2L) * 2 + T2L; // 1390 - low data bit delay
-const static uint16_t T2Y = T2X / 2; // 695 - decides 0 / 1
-const static uint16_t T2S1 = T2X * 2; // 2780 - low sync delay (FA500R)
-const static uint16_t T2S1MIN = T2S1 - 50;
-const static uint16_t T2S1MAX = T2S1 + 50;
-const static uint16_t T2S2 = T2L * 8; // 2640 - low sync delay (SF500R)
-const static uint16_t T2S2MIN = T2S2 - 50;
-const static uint16_t T2S2MAX = T2S2 + 50;
-
-// timings for 32bit rc3 multibit patterns
+#define T2X					((T2H + T2L) * 2 + T2L)	// 1390 - low data bit delay
+
+// 32bit rc3 multibit patterns, encoding unknown so decoded by hand
 #define T3H					220
 #define T3L					330
-const static uint16_t T3X = T3H + T3L + T3L; // 880 - low delay to next clock
-const static uint16_t T3Y = T3H + T3L; // 550 - decides if clock or data bit
-const static uint16_t T3S = 9250; // don't know how to calculate
-const static uint16_t T3SMIN = T3S - 50;
-const static uint16_t T3SMAX = T3S + 50;
-
-#define REPEAT_PAUSE1		5555
-#define REPEAT_PAUSE2		9999
-
-int flamingo_init();
+#define T3X					(T3H + T3L + T3L)		// 880 - low delay to next clock
+#define T3Y					(T3H + T3L)				// 550 - decides if clock or data bit
+#define T3S					9250					// don't know how to calculate
+#define T3SMIN				(T3S - 50)
+#define T3SMAX				(T3S + 50)
+
+// received protocols, numbering follows the old receiver patterns
+#define FLAMINGO_RC1		1					// 28bit rolling codes
+#define FLAMINGO_RC2		2					// 32bit messages
+#define FLAMINGO_RC3		3					// 32bit multibit messages, encoding still unknown
+#define FLAMINGO_RC4		4					// 24bit messages
+#define FLAMINGO_SF500		5					// 32bit rc2 with SF-500R sync and message coding
+
+// a decoded frame, tagged with the protocol it was received with
+typedef struct flamingo_frame_t {
+	int protocol;
+	uint32_t ts;							// timestamp of the last edge
+	uint32_t code;							// raw received code
+	uint32_t message;						// decrypted message
+	uint16_t xmitter;
+	uint8_t channel;
+	uint8_t command;
+	uint8_t payload;
+	uint8_t rolling;
+	uint8_t receiver;						// index of the RX pin that got the frame first
+	uint8_t valid;							// passed the codebook check, rc3 and rc4 never do, others failing it only go to promiscuous receivers
+	char multibit[33];						// rc3 data bit counts after each clock bit
+} flamingo_frame_t;
+
+// receiver state machine for one protocol family
+typedef struct flamingo_decoder_t {
+	int protocol;
+	int bits;
+	int symbol;								// measured pulses of the current bit
+	int databits;
+	uint32_t code;
+	char multibit[33];
+} flamingo_decoder_t;
+
+// all decoders running in parallel on one edge stream
+#define FLAMINGO_DECODERS	5
+
+typedef struct flamingo_receiver_t {
+	uint32_t last;
+	flamingo_decoder_t decoders[FLAMINGO_DECODERS];
+} flamingo_receiver_t;
+
+typedef void (*flamingo_handler_t)(const flamingo_frame_t *frame);
+
+// RX pins captured and decoded in parallel, duplicates are combined before the handler
+#define FLAMINGO_RECEIVERS	2
+
+// transmit job priorities, equal priorities are sent in order of submission
+#define FLAMINGO_PRIO_LOW		0
+#define FLAMINGO_PRIO_NORMAL	1
+#define FLAMINGO_PRIO_HIGH		2
+
+// transmit job results
+#define FLAMINGO_SENT			0				// all rolling codes sent
+#define FLAMINGO_SUPERSEDED		1				// replaced by a newer command for the same remote and channel
+#define FLAMINGO_CANCELED		2				// not completely sent on flamingo_close()
+
+// called when a job is finished, on the transmit thread or for superseded jobs on the submitting one, must not block
+typedef void (*flamingo_done_t)(int id, int result, void *arg);
+
+// receiver and transmitter counters
+typedef struct flamingo_stats_t {
+	uint32_t frames;						// frames delivered to the handler
+	uint32_t overwritten;					// frames overwritten in the queue before the handler saw them
+	uint32_t dropped;						// edges lost by the capture, each may have cost a frame
+	uint32_t repeats;						// repeated frames folded into the first one of a button press
+	uint32_t received[FLAMINGO_RECEIVERS];	// valid frames decoded per RX pin, before combining
+	uint32_t unknown;						// rc1, rc2 and SF-500R frames failing the codebook check, not delivered unless promiscuous
+	uint32_t transmitted;					// transmit jobs completely sent
+	uint32_t superseded;					// transmit jobs collapsed into a newer one
+	uint32_t throttled;						// frames delayed by the duty cycle limit
+	uint32_t airtime;						// ms on air since start
+	uint32_t backoffs;						// frames deferred while the band was busy
+	uint32_t collisions;					// frames sent into a busy band after all back-offs
+} flamingo_stats_t;
+
+// rolling code cipher, single message and batch variants
+uint32_t flamingo_encrypt(uint32_t message);
+uint32_t flamingo_decrypt(uint32_t code);
+void flamingo_encrypt_batch(const uint32_t *messages, uint32_t *codes, int count);
+void flamingo_decrypt_batch(const uint32_t *codes, uint32_t *messages, int count);
+
+int flamingo_init(flamingo_handler_t handler);
 void flamingo_close();
 
-void flamingo_send_FA500(int remote, char channel, int command, int rolling);
-void flamingo_send_SF500(int remote, char channel, int command);
+void flamingo_receiver_init(flamingo_receiver_t *r);
+int flamingo_receive_edge(flamingo_receiver_t *r, uint32_t ts, int level, flamingo_frame_t *frames);
+int flamingo_frame_decode(flamingo_frame_t *frame);
+const flamingo_stats_t* flamingo_stats();
+void flamingo_promiscuous(int on);
+void flamingo_dedup(int window);
+void flamingo_lbt(int window);
+int flamingo_record(const char *path);
+
+int flamingo_send_FA500(int remote, char channel, int command, int rolling);
+int flamingo_submit_FA500(int remote, char channel, int command, int rolling, int prio, flamingo_done_t done, void *arg);
 
 /*
 
@@ -29,29 +29,82 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <stddef.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
 #include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/eventfd.h>
 #include <sys/mman.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <linux/gpio.h>
 
 #include "gpio.h"
+#include "utils.h"
 
 #define PIO_REG_CFG(B, G)		(uint32_t*)(B) + (G/10)
-#define PIO_REG_SET(B, G)		(uint32_t*)(B) + (0x1C/4)
-#define PIO_REG_CLR(B, G)		(uint32_t*)(B) + (0x28/4)
-#define PIO_REG_GET(B, G)		(uint32_t*)(B) + (0x34/4)
-
-typedef struct {
-	int pin;
-	int func;
-	int data;
-} gpio_status_t;
+#define PIO_REG_SET(B, G)		(uint32_t*)(B) + (0x1C/4) + (G/32)
+#define PIO_REG_CLR(B, G)		(uint32_t*)(B) + (0x28/4) + (G/32)
+#define PIO_REG_GET(B, G)		(uint32_t*)(B) + (0x34/4) + (G/32)
+
+// don't sleep when less than this is left after subtracting the spin guard
+#define DELAY_SLEEP_MIN			50
+
+// minimum and maximum spin guard in front of a deadline
+#define DELAY_GUARD_MIN			20
+#define DELAY_GUARD_MAX			1000
+
+// character device for edge capture and the kernel side event buffer size
+#define GPIO_CHIP				"/dev/gpiochip0"
+#define GPIO_CHIP_EVENTS		1024
+
+struct gpio_capture_t {
+	int fd;
+	uint32_t seqno;
+	gpio_ring_t *ring;
+	pthread_t thread;
+};
+
+struct gpio_recorder_t {
+	FILE *f;
+	uint32_t edges;
+	uint32_t last;
+};
 
 static volatile void *gpio;
 static volatile uint32_t *timer;
 
+static int delay_strategy = GPIO_DELAY_HYBRID;
+
+// learned kernel wakeup latency, average scaled by 8 and mean deviation scaled by 4
+static int32_t wakeup_avg = 60 << 3;
+static int32_t wakeup_dev = 10 << 2;
+
+// optional per edge timing error recording of gpio_play()
+static int32_t *trace;
+
+#ifdef GPIO_SIM
+// simulated register backend for running on a non-Raspberry host
+static uint32_t sim_gpio[0x100];
+static uint32_t sim_timer[0x100];
+
+// captures get the edges of all played programs as if TX was wired to each RX
+#define SIM_CAPTURES		4
+static gpio_ring_t *sim_loopback[SIM_CAPTURES];
+
+static inline uint32_t micros() {
+	return mono_micros();
+}
+#else
+static inline uint32_t micros() {
+	return timer[1];
+}
+#endif
+
 #ifdef GPIO_MAIN
 static void test_lirc() {
 	const char *pio = "GPIO22";
@@ -80,6 +133,51 @@ static void test_flamingo() {
 	gpio_flamingo_v1(pio, 0x0253174e, 28, 4, 330);
 }
 
+static void test_program() {
+	gpio_program_t p;
+
+	printf("compiled flamingo v1 ON\n");
+	gpio_flamingo_v1_compile(&p, 0x02796056, 28, 4, 330);
+	gpio_program_print(&p);
+
+	printf("compiled flamingo v2\n");
+	gpio_flamingo_v2_compile(&p, 0x53cc0111, 32, 3, 200, 330);
+	gpio_program_print(&p);
+
+	printf("compiled lirc VOLUP\n");
+	gpio_lirc_compile(&p, 0x00FD20DF);
+	gpio_program_print(&p);
+}
+
+static void test_capture() {
+	const char *pio = "GPIO17";
+	gpio_ring_t *ring = malloc(sizeof(*ring));
+	gpio_edge_t e;
+	uint32_t last = 0;
+
+	gpio_ring_init(ring);
+	gpio_capture_t *c = gpio_capture_start(pio, ring);
+	if (c == NULL) {
+		gpio_ring_close(ring);
+		free(ring);
+		return;
+	}
+
+	printf("capturing edges on %s for 5 seconds\n", pio);
+	sleep(5);
+	gpio_capture_stop(c);
+
+	int count = 0;
+	while (gpio_ring_pop(ring, &e)) {
+		if (count++ < 32)
+			printf("%c%u ", e.level ? 'H' : 'L', e.ts - last);
+		last = e.ts;
+	}
+	printf("\n%d edges captured, %u dropped\n", count, ring->dropped);
+	gpio_ring_close(ring);
+	free(ring);
+}
+
 static void test_blink() {
 	const char *pio = "GPIO17";
 
@@ -96,12 +194,14 @@ static void test_blink() {
 	sleep(1);
 
 	printf("blink test\n");
+	gpio_pin_t pin;
+	gpio_pin(&pin, pio);
 	for (int i = 0; i < 3; i++) {
-		gpio_set(pio, 1);
-		gpio_print(pio);
+		gpio_pin_set(&pin, 1);
+		gpio_pin_print(&pin);
 		sleep(1);
-		gpio_set(pio, 0);
-		gpio_print(pio);
+		gpio_pin_set(&pin, 0);
+		gpio_pin_print(&pin);
 		sleep(1);
 	}
 	sleep(1);
@@ -148,6 +248,8 @@ static int gpio_main(int argc, char **argv) {
 	printf("mmap OK\n");
 
 	test_timers();
+	test_program();
+//	test_capture();
 //	test_lirc();
 //	test_flamingo();
 	test_blink();
@@ -157,122 +259,504 @@ static int gpio_main(int argc, char **argv) {
 }
 #endif
 
-static void mem_read(gpio_status_t *pio) {
-	uint32_t *addr;
-	int offset_func = (pio->pin % 10) * 3;
+int gpio_pin(gpio_pin_t *p, const char *name) {
+	while (*name >= 'A')
+		name++;
 
-	/* function */
-	addr = PIO_REG_CFG(gpio, pio->pin);
-	pio->func = (*addr >> offset_func) & 0x07;
+	int pin = atoi(name);
+	if (*name == '\0' || pin < 0 || pin > 53)
+		return -1;
 
-	/* data */
-	addr = PIO_REG_GET(gpio, pio->pin);
-	pio->data = (*addr >> pio->pin) & 0x01;
+	p->pin = pin;
+	p->bit = 1 << (pin % 32);
+	p->cfg = PIO_REG_CFG(gpio, pin);
+	p->set = PIO_REG_SET(gpio, pin);
+	p->clr = PIO_REG_CLR(gpio, pin);
+	p->lev = PIO_REG_GET(gpio, pin);
+	return 0;
 }
 
-static void mem_write(gpio_status_t *pio) {
-	uint32_t *addr, val;
-	int offset_func = (pio->pin % 10) * 3;
-	uint32_t bit = 1 << pio->pin;
+int gpio_pin_configure(const gpio_pin_t *p, int function, int trigger, int initial) {
+	int offset_func = (p->pin % 10) * 3;
+	uint32_t val;
 
 	/* function */
-	addr = PIO_REG_CFG(gpio, pio->pin);
-	val = *addr;
+	val = *p->cfg;
 	val &= ~(0x07 << offset_func);
-	val |= (pio->func & 0x07) << offset_func;
-	*addr = val;
+	val |= (function & 0x07) << offset_func;
+	*p->cfg = val;
 
 	/* initial value - only if 0/1 - otherwise leave unchanged */
-	if (pio->data == 0) {
-		addr = PIO_REG_CLR(gpio, pin);
-		val = *addr;
-		val |= bit;
-		*addr = val;
-	} else if (pio->data == 1) {
-		addr = PIO_REG_SET(gpio, pin);
-		val = *addr;
-		val |= bit;
-		*addr = val;
+	if (initial == 0)
+		*p->clr = p->bit;
+	else if (initial == 1)
+		*p->set = p->bit;
+	else
+		initial = *p->lev & p->bit ? 1 : 0;
+
+	return initial;
+}
+
+void gpio_pin_print(const gpio_pin_t *p) {
+	int offset_func = (p->pin % 10) * 3;
+
+	printf("GPIO%d", p->pin);
+	printf("<%x>", (*p->cfg >> offset_func) & 0x07);
+	printf("<%x>", gpio_pin_get(p));
+	printf("\n");
+}
+
+int gpio_pin_get(const gpio_pin_t *p) {
+	return *p->lev & p->bit ? 1 : 0;
+}
+
+void gpio_pin_set(const gpio_pin_t *p, int value) {
+	if (value)
+		*p->set = p->bit;
+	else
+		*p->clr = p->bit;
+}
+
+int gpio_pin_toggle(const gpio_pin_t *p) {
+	if (*p->lev & p->bit) {
+		*p->clr = p->bit;
+		return 0;
 	} else {
-		addr = PIO_REG_GET(gpio, pio->pin);
-		val = *addr;
-		pio->data = (val >> pio->pin) & 0x01;
+		*p->set = p->bit;
+		return 1;
 	}
 }
 
 void gpio_print(const char *name) {
-	while (*name >= 'A')
-		name++;
+	gpio_pin_t p;
 
-	gpio_status_t pio;
-	pio.pin = atoi(name);
-	mem_read(&pio);
-	printf("GPIO%d", pio.pin);
-	printf("<%x>", pio.func);
-	printf("<%x>", pio.data);
-	printf("\n");
+	if (gpio_pin(&p, name) == 0)
+		gpio_pin_print(&p);
 }
 
 int gpio_configure(const char *name, int function, int trigger, int initial) {
-	while (*name >= 'A')
-		name++;
+	gpio_pin_t p;
+
+	if (gpio_pin(&p, name) < 0)
+		return -1;
 
-	gpio_status_t pio;
-	pio.pin = atoi(name);
-	pio.func = function;
-	pio.data = initial;
-	mem_write(&pio);
-	return pio.data;
+	return gpio_pin_configure(&p, function, trigger, initial);
 }
 
 int gpio_get(const char *name) {
-	while (*name >= 'A')
-		name++;
+	gpio_pin_t p;
 
-	int pin = atoi(name);
-	uint32_t *addr = PIO_REG_GET(gpio, pio->pin);
-	return (*addr >> pin) & 0x01;
+	if (gpio_pin(&p, name) < 0)
+		return -1;
+
+	return gpio_pin_get(&p);
 }
 
 void gpio_set(const char *name, int value) {
-	while (*name >= 'A')
-		name++;
+	gpio_pin_t p;
 
-	uint32_t bit = 1 << atoi(name);
-	uint32_t *addr, val;
-	if (value) {
-		addr = PIO_REG_SET(gpio, pin);
-		val = *addr;
-		val |= bit;
-		*addr = val;
-	} else {
-		addr = PIO_REG_CLR(gpio, pin);
-		val = *addr;
-		val |= bit;
-		*addr = val;
-	}
+	if (gpio_pin(&p, name) == 0)
+		gpio_pin_set(&p, value);
 }
 
 int gpio_toggle(const char *name) {
-	while (*name >= 'A')
-		name++;
+	gpio_pin_t p;
+
+	if (gpio_pin(&p, name) < 0)
+		return -1;
+
+	return gpio_pin_toggle(&p);
+}
+
+void gpio_ring_init(gpio_ring_t *r) {
+	r->head = 0;
+	r->tail = 0;
+	r->dropped = 0;
+	r->efd = eventfd(0, 0);
+}
 
-	uint32_t bit = 1 << atoi(name);
-	uint32_t *addr, val;
-	addr = PIO_REG_GET(gpio, pin);
-	if (*addr & bit) {
-		addr = PIO_REG_CLR(gpio, pin);
-		val = *addr;
-		val |= bit;
-		*addr = val;
+void gpio_ring_close(gpio_ring_t *r) {
+	if (r->efd >= 0)
+		close(r->efd);
+	r->efd = -1;
+}
+
+// producer side, wake up a consumer blocked in gpio_ring_wait()
+void gpio_ring_notify(gpio_ring_t *r) {
+	uint64_t one = 1;
+
+	if (r->efd >= 0)
+		write(r->efd, &one, sizeof(one));
+}
+
+// consumer side, blocks until the producer has pushed new edges, -1 when the ring can't be waited on anymore
+int gpio_ring_wait(gpio_ring_t *r) {
+	uint64_t count;
+
+	if (gpio_ring_count(r))
 		return 0;
-	} else {
-		addr = PIO_REG_SET(gpio, pin);
-		val = *addr;
-		val |= bit;
-		*addr = val;
-		return 1;
+
+	while (read(r->efd, &count, sizeof(count)) != sizeof(count))
+		if (errno != EINTR)
+			return -1;
+
+	return 0;
+}
+
+// producer side, never blocks - counts the edge as dropped when the ring is full
+int gpio_ring_push(gpio_ring_t *r, uint32_t ts, int level) {
+	uint32_t head = r->head;
+	uint32_t tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+
+	if (head - tail == GPIO_RING_SIZE) {
+		r->dropped++;
+		return -1;
+	}
+
+	gpio_edge_t *e = &r->edges[head & (GPIO_RING_SIZE - 1)];
+	e->ts = ts;
+	e->level = level;
+	__atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+// consumer side, returns 0 when the ring is empty
+int gpio_ring_pop(gpio_ring_t *r, gpio_edge_t *e) {
+	uint32_t tail = r->tail;
+	uint32_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+
+	if (head == tail)
+		return 0;
+
+	*e = r->edges[tail & (GPIO_RING_SIZE - 1)];
+	__atomic_store_n(&r->tail, tail + 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+uint32_t gpio_ring_count(const gpio_ring_t *r) {
+	return __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+}
+
+// edges are timestamped by the kernel in interrupt context, so scheduling latency of this thread doesn't matter
+static void* capture_loop(void *arg) {
+	gpio_capture_t *c = (gpio_capture_t*) arg;
+	struct gpio_v2_line_event events[64];
+
+	while (1) {
+		ssize_t n = read(c->fd, events, sizeof(events));
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			printf("edge capture read failed: %s\n", strerror(errno));
+			return (void*) 0;
+		}
+
+		for (struct gpio_v2_line_event *e = events; e < events + n / sizeof(*e); e++) {
+			// a gap in the sequence number means the kernel buffer overflowed
+			if (c->seqno && e->line_seqno != c->seqno + 1)
+				c->ring->dropped += e->line_seqno - c->seqno - 1;
+			c->seqno = e->line_seqno;
+			gpio_ring_push(c->ring, e->timestamp_ns / 1000, e->id == GPIO_V2_LINE_EVENT_RISING_EDGE);
+		}
+		gpio_ring_notify(c->ring);
+	}
+}
+
+gpio_capture_t* gpio_capture_start(const char *name, gpio_ring_t *ring) {
+	struct gpio_v2_line_request req;
+	struct sched_param sp;
+	gpio_pin_t pin;
+
+	if (gpio_pin(&pin, name) < 0)
+		return NULL;
+
+#ifdef GPIO_SIM
+	// no character device, fed by gpio_play()
+	gpio_capture_t *sc = malloc(sizeof(*sc));
+	memset(sc, 0, sizeof(*sc));
+	sc->fd = -1;
+	sc->ring = ring;
+	for (int i = 0; i < SIM_CAPTURES; i++)
+		if (sim_loopback[i] == NULL) {
+			sim_loopback[i] = ring;
+			break;
+		}
+	return sc;
+#endif
+
+	int fd = open(GPIO_CHIP, O_RDONLY);
+	if (fd == -1) {
+		printf("%s failed: %s\n", GPIO_CHIP, strerror(errno));
+		return NULL;
+	}
+
+	memset(&req, 0, sizeof(req));
+	req.offsets[0] = pin.pin;
+	req.num_lines = 1;
+	req.event_buffer_size = GPIO_CHIP_EVENTS;
+	req.config.flags = GPIO_V2_LINE_FLAG_INPUT | GPIO_V2_LINE_FLAG_EDGE_RISING | GPIO_V2_LINE_FLAG_EDGE_FALLING;
+	strncpy(req.consumer, "picam-capture", sizeof(req.consumer) - 1);
+	if (ioctl(fd, GPIO_V2_GET_LINE_IOCTL, &req) < 0) {
+		printf("edge capture request for GPIO%d failed: %s\n", pin.pin, strerror(errno));
+		close(fd);
+		return NULL;
+	}
+	close(fd);
+
+	gpio_capture_t *c = malloc(sizeof(*c));
+	memset(c, 0, sizeof(*c));
+	c->fd = req.fd;
+	c->ring = ring;
+	if (pthread_create(&c->thread, NULL, &capture_loop, c)) {
+		printf("Error creating capture thread\n");
+		close(c->fd);
+		free(c);
+		return NULL;
 	}
+
+	// not required for timestamp accuracy but keeps the kernel event buffer drained under load
+	sp.sched_priority = sched_get_priority_max(SCHED_FIFO);
+	pthread_setschedparam(c->thread, SCHED_FIFO, &sp);
+
+	return c;
+}
+
+void gpio_capture_stop(gpio_capture_t *c) {
+	if (c == NULL)
+		return;
+
+#ifdef GPIO_SIM
+	for (int i = 0; i < SIM_CAPTURES; i++)
+		if (sim_loopback[i] == c->ring)
+			sim_loopback[i] = NULL;
+	free(c);
+	return;
+#endif
+
+	pthread_cancel(c->thread);
+	pthread_join(c->thread, NULL);
+	close(c->fd);
+	free(c);
+}
+
+gpio_recorder_t* gpio_record_start(const char *path) {
+	gpio_record_header_t h;
+
+	FILE *f = fopen(path, "w");
+	if (f == NULL) {
+		printf("%s failed: %s\n", path, strerror(errno));
+		return NULL;
+	}
+
+	memset(&h, 0, sizeof(h));
+	h.magic = GPIO_RECORD_MAGIC;
+	h.version = GPIO_RECORD_VERSION;
+	fwrite(&h, sizeof(h), 1, f);
+
+	gpio_recorder_t *r = malloc(sizeof(*r));
+	memset(r, 0, sizeof(*r));
+	r->f = f;
+	return r;
+}
+
+int gpio_record_edge(gpio_recorder_t *r, const gpio_edge_t *e) {
+	uint16_t rec[3];
+	int n = 0;
+
+	// the first edge is the time base
+	if (r->edges++ == 0) {
+		gpio_record_header_t h = { GPIO_RECORD_MAGIC, GPIO_RECORD_VERSION, 0, e->ts };
+		fseek(r->f, 0, SEEK_SET);
+		fwrite(&h, sizeof(h), 1, r->f);
+		r->last = e->ts;
+	}
+
+	uint32_t delta = e->ts - r->last;
+	uint16_t level = e->level ? 0x8000 : 0;
+	r->last = e->ts;
+	if (delta < GPIO_RECORD_ESCAPE)
+		rec[n++] = level | delta;
+	else {
+		rec[n++] = level | GPIO_RECORD_ESCAPE;
+		rec[n++] = delta & 0xFFFF;
+		rec[n++] = delta >> 16;
+	}
+	return fwrite(rec, sizeof(uint16_t), n, r->f) == n ? 0 : -1;
+}
+
+void gpio_record_stop(gpio_recorder_t *r) {
+	if (r == NULL)
+		return;
+
+	// edge count is only valid after a clean stop
+	fseek(r->f, offsetof(gpio_record_header_t, edges), SEEK_SET);
+	fwrite(&r->edges, sizeof(r->edges), 1, r->f);
+	fclose(r->f);
+	free(r);
+}
+
+int gpio_replay_open(gpio_replay_t *r, const char *path) {
+	struct stat st;
+
+	memset(r, 0, sizeof(*r));
+	int fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		printf("%s failed: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	if (fstat(fd, &st) < 0 || st.st_size < sizeof(gpio_record_header_t)) {
+		printf("%s: not an edge recording\n", path);
+		close(fd);
+		return -2;
+	}
+
+	void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		printf("mmap %s failed: %s\n", path, strerror(errno));
+		return -3;
+	}
+
+	r->header = map;
+	r->size = st.st_size;
+	if (r->header->magic != GPIO_RECORD_MAGIC || r->header->version != GPIO_RECORD_VERSION) {
+		printf("%s: not an edge recording\n", path);
+		gpio_replay_close(r);
+		return -2;
+	}
+
+	// a recording that was not stopped cleanly is read up to the last complete record
+	r->end = (const uint16_t*) (r->header + 1) + (st.st_size - sizeof(gpio_record_header_t)) / sizeof(uint16_t);
+	gpio_replay_rewind(r);
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+	return 0;
+}
+
+// start over with the first edge
+void gpio_replay_rewind(gpio_replay_t *r) {
+	r->next = (const uint16_t*) (r->header + 1);
+	r->ts = r->header->start;
+}
+
+// returns 0 at the end of the recording
+int gpio_replay_next(gpio_replay_t *r, gpio_edge_t *e) {
+	if (r->next >= r->end)
+		return 0;
+
+	uint16_t rec = *r->next++;
+	uint32_t delta = rec & 0x7FFF;
+	if (delta == GPIO_RECORD_ESCAPE) {
+		if (r->end - r->next < 2)
+			return 0;
+		delta = r->next[0] | r->next[1] << 16;
+		r->next += 2;
+	}
+
+	r->ts += delta;
+	e->ts = r->ts;
+	e->level = rec >> 15;
+	return 1;
+}
+
+void gpio_replay_close(gpio_replay_t *r) {
+	if (r->header)
+		munmap((void*) r->header, r->size);
+	r->header = NULL;
+}
+
+void gpio_program_clear(gpio_program_t *p) {
+	p->count = 0;
+	p->duration = 0;
+	p->pause = 0;
+}
+
+// append a pulse, consecutive pulses with same level are merged into one
+int gpio_program_add(gpio_program_t *p, int level, uint32_t us) {
+	level = level ? 1 : 0;
+	p->duration += us;
+
+	if (p->count && p->pulses[p->count - 1].level == level) {
+		p->pulses[p->count - 1].us += us;
+		return 0;
+	}
+
+	if (p->count == GPIO_PROGRAM_SIZE)
+		return -1;
+
+	gpio_pulse_t *pulse = &p->pulses[p->count++];
+	pulse->level = level;
+	pulse->us = us;
+	return 0;
+}
+
+void gpio_program_print(const gpio_program_t *p) {
+	printf("program %d pulses, %u us + %u us pause\n", p->count, p->duration, p->pause);
+	for (int i = 0; i < p->count; i++)
+		printf("%c%u%s", p->pulses[i].level ? 'H' : 'L', p->pulses[i].us, (i % 16) == 15 ? "\n" : " ");
+	printf("\n");
+}
+
+// compile any protocol described by sync, bit symbols, tail and gaps
+int gpio_protocol_compile(gpio_program_t *p, const gpio_protocol_t *proto, uint32_t message) {
+	int err = 0;
+
+	gpio_program_clear(p);
+	for (int r = 0; r < proto->repeat; r++) {
+		err |= gpio_program_add(p, 1, proto->sync[0]);
+		err |= gpio_program_add(p, 0, proto->sync[1]);
+
+		for (uint32_t mask = 1 << (proto->bits - 1); mask; mask >>= 1) {
+			const uint16_t *symbol = message & mask ? proto->one : proto->zero;
+			for (int i = 0; i < GPIO_SYMBOL_SIZE && symbol[i]; i++)
+				err |= gpio_program_add(p, !(i & 1), symbol[i]);
+		}
+
+		if (proto->tail[0]) {
+			err |= gpio_program_add(p, 1, proto->tail[0]);
+			err |= gpio_program_add(p, 0, proto->tail[1]);
+		}
+
+		if (proto->gap)
+			err |= gpio_program_add(p, 0, proto->gap);
+	}
+	p->pause = proto->pause;
+	return err;
+}
+
+// execute a precompiled pulse program, each pulse ends on an absolute deadline so errors do not accumulate
+void gpio_play(const gpio_pin_t *pin, const gpio_program_t *p) {
+	volatile uint32_t *set = pin->set;
+	volatile uint32_t *clr = pin->clr;
+	const uint32_t bit = pin->bit;
+	const gpio_pulse_t *pulse = p->pulses;
+	const gpio_pulse_t *end = p->pulses + p->count;
+
+	uint32_t deadline = micros();
+	while (pulse < end) {
+		if (pulse->level)
+			*set = bit;
+		else
+			*clr = bit;
+		if (trace)
+			trace[pulse - p->pulses] = micros() - deadline;
+#ifdef GPIO_SIM
+		for (int i = 0; i < SIM_CAPTURES; i++)
+			if (sim_loopback[i])
+				gpio_ring_push(sim_loopback[i], micros(), pulse->level);
+#endif
+		deadline += pulse->us;
+		gpio_delay_until(deadline);
+		pulse++;
+	}
+#ifdef GPIO_SIM
+	for (int i = 0; i < SIM_CAPTURES; i++)
+		if (sim_loopback[i])
+			gpio_ring_notify(sim_loopback[i]);
+#endif
+
+	if (p->pause)
+		usleep(p->pause);
 }
 
 //
@@ -284,41 +768,27 @@ int gpio_toggle(const char *name) {
 //
 // https://forum.arduino.cc/index.php?topic=201771.0
 //
+int gpio_flamingo_v1_compile(gpio_program_t *p, uint32_t message, int bits, int repeat, int pulse) {
+	gpio_protocol_t proto = {
+		.bits = bits,
+		.repeat = repeat,
+		.sync = { pulse, pulse * 15 },
+		.zero = { pulse, pulse * 3 },
+		.one = { pulse * 3, pulse },
+		.pause = pulse * 50,
+	};
+	return gpio_protocol_compile(p, &proto, message);
+}
+
 void gpio_flamingo_v1(const char *name, uint32_t message, int bits, int repeat, int pulse) {
-	while (*name >= 'A')
-		name++;
+	gpio_program_t p;
+	gpio_pin_t pin;
 
-	int pin = atoi(name);
-	uint32_t bit = 1 << pin;
-	uint32_t *set = PIO_REG_SET(gpio, pin);
-	uint32_t *clr = PIO_REG_CLR(gpio, pin);
-	while (repeat--) {
-		uint32_t mask = 1 << (bits - 1);
-
-		// sync
-		*set |= bit;
-		gpio_delay_micros(pulse);
-		*clr |= bit;
-		gpio_delay_micros(pulse * 15);
-
-		while (mask) {
-			if (message & mask) {
-				// 1
-				*set |= bit;
-				gpio_delay_micros(pulse * 3);
-				*clr |= bit;
-				gpio_delay_micros(pulse);
-			} else {
-				// 0
-				*set |= bit;
-				gpio_delay_micros(pulse);
-				*clr |= bit;
-				gpio_delay_micros(pulse * 3);
-			}
-			mask = mask >> 1;
-		}
-	}
-	usleep(pulse * 50);
+	if (gpio_pin(&pin, name) < 0)
+		return;
+
+	if (gpio_flamingo_v1_compile(&p, message, bits, repeat, pulse) == 0)
+		gpio_play(&pin, &p);
 }
 
 //
@@ -335,110 +805,145 @@ void gpio_flamingo_v1(const char *name, uint32_t message, int bits, int repeat,
 // 3=Channel, 4 bit
 //
 // https://forum.pilight.org/showthread.php?tid=1110&page=12
-void gpio_flamingo_v2(const char *name, uint32_t message, int bits, int repeat, int phi, int plo) {
-	while (*name >= 'A')
-		name++;
-
+int gpio_flamingo_v2_compile(gpio_program_t *p, uint32_t message, int bits, int repeat, int phi, int plo) {
 	int px = (phi + plo) * 2 + plo;
 	int sync = px * 2;
-	int pin = atoi(name);
 
-	uint32_t bit = 1 << pin;
-	uint32_t *set = PIO_REG_SET(gpio, pin);
-	uint32_t *clr = PIO_REG_CLR(gpio, pin);
-	while (repeat--) {
-		uint32_t mask = 1 << (bits - 1);
-
-		// sync
-		*set |= bit;
-		gpio_delay_micros(phi);
-		*clr |= bit;
-		gpio_delay_micros(sync);
-
-		while (mask) {
-			if (message & mask) {
-				// 1
-				*set |= bit;
-				gpio_delay_micros(phi);
-				*clr |= bit;
-				gpio_delay_micros(px);
-				*set |= bit;
-				gpio_delay_micros(phi);
-				*clr |= bit;
-				gpio_delay_micros(plo);
-			} else {
-				// 0
-				*set |= bit;
-				gpio_delay_micros(phi);
-				*clr |= bit;
-				gpio_delay_micros(plo);
-				*set |= bit;
-				gpio_delay_micros(phi);
-				*clr |= bit;
-				gpio_delay_micros(px);
-			}
-
-			mask = mask >> 1;
-		}
+	gpio_protocol_t proto = {
+		.bits = bits,
+		.repeat = repeat,
+		.sync = { phi, sync },
+		.zero = { phi, plo, phi, px },
+		.one = { phi, px, phi, plo },
+		.tail = { phi, plo },					// a clock or parity (?) bit terminates the message
+		.gap = sync * 4,						// wait before sending next sync
+		.pause = sync * 50,
+	};
+	return gpio_protocol_compile(p, &proto, message);
+}
 
-		// a clock or parity (?) bit terminates the message
-		*set |= bit;
-		gpio_delay_micros(phi);
-		*clr |= bit;
-		gpio_delay_micros(plo);
+void gpio_flamingo_v2(const char *name, uint32_t message, int bits, int repeat, int phi, int plo) {
+	gpio_program_t p;
+	gpio_pin_t pin;
 
-		// wait before sending next sync
-		gpio_delay_micros(sync * 4);
-	}
-	usleep(sync * 50);
-}
+	if (gpio_pin(&pin, name) < 0)
+		return;
 
-void gpio_lirc(const char *name, uint32_t message) {
-	while (*name >= 'A')
-		name++;
+	if (gpio_flamingo_v2_compile(&p, message, bits, repeat, phi, plo) == 0)
+		gpio_play(&pin, &p);
+}
 
-	int pin = atoi(name);
-	uint32_t bit = 1 << pin;
-	uint32_t *set = PIO_REG_SET(gpio, pin);
-	uint32_t *clr = PIO_REG_CLR(gpio, pin);
+int gpio_lirc_compile(gpio_program_t *p, uint32_t message) {
 	uint32_t mask = 1 << 31;
+	int err = 0;
+
+	gpio_program_clear(p);
 
 	// sync
-	*clr |= bit;
-	gpio_delay_micros(9020);
-	*set |= bit;
-	gpio_delay_micros(4460);
+	err |= gpio_program_add(p, 0, 9020);
+	err |= gpio_program_add(p, 1, 4460);
 
 	while (mask) {
-		*clr |= bit;
-		gpio_delay_micros(580);
-		*set |= bit;
+		err |= gpio_program_add(p, 0, 580);
 		if (message & mask)
-			gpio_delay_micros(1660); // 1
+			err |= gpio_program_add(p, 1, 1660); // 1
 		else
-			gpio_delay_micros(550); // 0
+			err |= gpio_program_add(p, 1, 550); // 0
 		mask = mask >> 1;
 	}
-	*clr |= bit;
-	gpio_delay_micros(580);
-	*set |= bit;
-	usleep(150 * 1000);
+	err |= gpio_program_add(p, 0, 580);
+	err |= gpio_program_add(p, 1, 0);
+	p->pause = 150 * 1000;
+	return err;
+}
+
+void gpio_lirc(const char *name, uint32_t message) {
+	gpio_program_t p;
+	gpio_pin_t pin;
+
+	if (gpio_pin(&pin, name) < 0)
+		return;
+
+	if (gpio_lirc_compile(&p, message) == 0)
+		gpio_play(&pin, &p);
 }
 
 void gpio_delay_micros(uint32_t us) {
-	// usleep() on its own gives latencies 20-40 us; this combination gives < 25 us.
-	uint32_t start = timer[1];
-	if (us >= 100)
-		usleep(us - 80);
-	while ((timer[1] - start) < us);
+	gpio_delay_until(micros() + us);
+}
+
+// wakeup latency estimator, same smoothing as the TCP round trip time estimator
+static void delay_learn(int32_t late) {
+	int32_t err = late - (wakeup_avg >> 3);
+	wakeup_avg += err;
+	if (err < 0)
+		err = -err;
+	wakeup_dev += err - (wakeup_dev >> 2);
+}
+
+static uint32_t delay_guard() {
+	int32_t guard = (wakeup_avg >> 3) + wakeup_dev + DELAY_GUARD_MIN;
+	if (guard < DELAY_GUARD_MIN)
+		return DELAY_GUARD_MIN;
+	if (guard > DELAY_GUARD_MAX)
+		return DELAY_GUARD_MAX;
+	return guard;
+}
+
+// sleep on the monotonic clock until shortly before the deadline, then spin the remaining microseconds
+static void delay_hybrid(uint32_t deadline) {
+	struct timespec ts;
+
+	uint32_t guard = delay_guard();
+	int32_t us = (int32_t) (deadline - micros()) - guard;
+	if (us < DELAY_SLEEP_MIN)
+		return;
+
+	uint32_t wakeup = deadline - guard;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	ts.tv_nsec += us * 1000L;
+	ts.tv_sec += ts.tv_nsec / 1000000000L;
+	ts.tv_nsec %= 1000000000L;
+	if (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == 0)
+		delay_learn(micros() - wakeup);
+}
+
+void gpio_delay_until(uint32_t deadline) {
+	// signed distance handles timer wrap around and deadlines already passed
+	int32_t us = deadline - micros();
+
+	switch (delay_strategy) {
+	case GPIO_DELAY_HYBRID:
+		delay_hybrid(deadline);
+		break;
+	case GPIO_DELAY_USLEEP:
+		// usleep() on its own gives latencies 20-40 us; this combination gives < 25 us.
+		if (us >= 100)
+			usleep(us - 80);
+		break;
+	}
+
+	while ((int32_t) (deadline - micros()) > 0);
+}
+
+void gpio_delay_strategy(int strategy) {
+	delay_strategy = strategy;
+}
+
+uint32_t gpio_delay_latency() {
+	return wakeup_avg >> 3;
+}
+
+void gpio_trace(int32_t *errors) {
+	trace = errors;
 }
 
 uint32_t gpio_micros() {
-	return timer[1];
+	return micros();
 }
 
 uint32_t gpio_micros_since(uint32_t *when) {
-	uint32_t now = timer[1];
+	uint32_t now = micros();
 	uint32_t elapsed;
 	if (now > *when)
 		elapsed = now - *when;
@@ -454,6 +959,13 @@ int gpio_init() {
 	if (timer != 0 && gpio != 0)
 		return 0; // already initalized
 
+#ifdef GPIO_SIM
+	// plain memory as registers, timer derived from the monotonic clock
+	gpio = sim_gpio;
+	timer = sim_timer;
+	return 0;
+#endif
+
 	// figure out the IO Base Address
 	FILE *f = fopen("/proc/cpuinfo", "r");
 	char buf[1024];
@@ -498,9 +1010,13 @@ int gpio_init() {
 }
 
 void gpio_close() {
+#ifndef GPIO_SIM
 	int pagesize = sysconf(_SC_PAGESIZE);
 	munmap((void*) gpio, pagesize);
 	munmap((void*) timer, pagesize);
+#endif
+	gpio = 0;
+	timer = 0;
 }
 
 #ifdef GPIO_MAIN
@@ -0,0 +1,178 @@
+/*
+ * edge timing benchmark for the pulse program player
+ *
+ * plays the flamingo v1, flamingo v2 and lirc programs with every delay
+ * strategy and compares each edge against the ideal timeline
+ *
+ * build with -DGPIO_SIM to run on any Linux host without /dev/mem, the simulated
+ * timer is the host's monotonic clock, so preemption on a loaded or single CPU
+ * host shows up as edge errors of several ms in p99 and max for every strategy,
+ * only the cpu column and p50 are comparable there, tail figures need a Pi
+ *
+ * "usleep" is the delay used before the hybrid strategy: usleep(us - 80) and
+ * spinning the rest towards the same absolute deadline
+ *
+ * (C) Copyright 2022 Heiko Jehmlich <hje@jecons.de>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston,
+ * MA 02111-1307 USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "gpio.h"
+#include "utils.h"
+
+#define PIO					"GPIO17"
+
+// histogram buckets of 5us, last bucket collects everything above
+#define BUCKET_WIDTH		5
+#define BUCKETS				20
+
+static const char *strategies[] = { "spin", "usleep", "hybrid" };
+
+static const char *protocols[] = { "flamingo_v1", "flamingo_v2", "lirc" };
+
+static int compare_abs(const void *a, const void *b) {
+	int32_t x = abs(*(const int32_t*) a), y = abs(*(const int32_t*) b);
+	return (x > y) - (x < y);
+}
+
+static long cpu_micros() {
+	struct rusage r;
+	getrusage(RUSAGE_SELF, &r);
+	return (r.ru_utime.tv_sec + r.ru_stime.tv_sec) * 1000000L + r.ru_utime.tv_usec + r.ru_stime.tv_usec;
+}
+
+static void compile(gpio_program_t *p, int protocol) {
+	switch (protocol) {
+	case 0:
+		gpio_flamingo_v1_compile(p, 0x02796056, 28, 4, 330);
+		break;
+	case 1:
+		gpio_flamingo_v2_compile(p, 0x53cc0111, 32, 3, 200, 330);
+		break;
+	case 2:
+		gpio_lirc_compile(p, 0x00FD20DF);
+		break;
+	}
+
+	// not interested in the idle time after a burst
+	p->pause = 0;
+}
+
+static void histogram(const int32_t *errors, int count) {
+	int buckets[BUCKETS];
+	int max = 1;
+
+	for (int i = 0; i < BUCKETS; i++)
+		buckets[i] = 0;
+
+	for (int i = 0; i < count; i++) {
+		int b = abs(errors[i]) / BUCKET_WIDTH;
+		buckets[b < BUCKETS ? b : BUCKETS - 1]++;
+	}
+
+	for (int i = 0; i < BUCKETS; i++)
+		if (buckets[i] > max)
+			max = buckets[i];
+
+	for (int i = 0; i < BUCKETS; i++) {
+		if (!buckets[i])
+			continue;
+		printf("    %3d%s us %6d ", i * BUCKET_WIDTH, i == BUCKETS - 1 ? "+  " : "..", buckets[i]);
+		for (int j = 0; j < buckets[i] * 50 / max; j++)
+			printf("#");
+		printf("\n");
+	}
+}
+
+static void bench(const gpio_pin_t *pin, int protocol, int strategy, int runs) {
+	gpio_program_t p;
+	int32_t *errors, *e;
+
+	compile(&p, protocol);
+	errors = malloc(sizeof(int32_t) * p.count * runs);
+	if (errors == NULL)
+		return;
+
+	gpio_delay_strategy(strategy);
+	long cpu = cpu_micros();
+	for (e = errors; e < errors + p.count * runs; e += p.count) {
+		gpio_trace(e);
+		gpio_play(pin, &p);
+		gpio_trace(NULL);
+	}
+	cpu = cpu_micros() - cpu;
+
+	int count = p.count * runs;
+	qsort(errors, count, sizeof(int32_t), &compare_abs);
+	printf("%-12s %-7s edges %5d  cpu %3ld%%  p50 %4d  p99 %4d  max %5d us\n", protocols[protocol], strategies[strategy], count,
+			cpu * 100 / ((long) p.duration * runs), abs(errors[count / 2]), abs(errors[count * 99 / 100]), abs(errors[count - 1]));
+	histogram(errors, count);
+
+	free(errors);
+}
+
+static int usage() {
+	printf("Usage: gpio-bench [-n runs] [-p protocol] [-s strategy]\n");
+	printf("    -n runs      repetitions of each program, default 10\n");
+	printf("    -p protocol  0 flamingo_v1, 1 flamingo_v2, 2 lirc, default all\n");
+	printf("    -s strategy  0 spin, 1 usleep, 2 hybrid, default all\n");
+	return EXIT_FAILURE;
+}
+
+int main(int argc, char **argv) {
+	int runs = 10, protocol = -1, strategy = -1, c;
+	gpio_pin_t pin;
+
+	while ((c = getopt(argc, argv, "n:p:s:")) != -1)
+		switch (c) {
+		case 'n':
+			runs = atoi(optarg);
+			break;
+		case 'p':
+			protocol = atoi(optarg);
+			break;
+		case 's':
+			strategy = atoi(optarg);
+			break;
+		default:
+			return usage();
+		}
+
+	if (runs < 1 || protocol >= (int) ARRAY_SIZE(protocols) || strategy >= (int) ARRAY_SIZE(strategies))
+		return usage();
+
+	if (gpio_init() < 0)
+		return EXIT_FAILURE;
+
+	gpio_pin(&pin, PIO);
+	gpio_pin_configure(&pin, 1, 0, 0);
+
+	for (int i = 0; i < ARRAY_SIZE(protocols); i++)
+		for (int j = 0; j < ARRAY_SIZE(strategies); j++)
+			if ((protocol < 0 || protocol == i) && (strategy < 0 || strategy == j))
+				bench(&pin, i, j, runs);
+
+	printf("learned wakeup latency %u us\n", gpio_delay_latency());
+	gpio_close();
+	return EXIT_SUCCESS;
+}
@@ -19,7 +19,119 @@
  * MA 02111-1307 USA
  */
 
-// generic GPIO functions
+// a single level held for a duration, the building block of a pulse program
+typedef struct gpio_pulse_t {
+	uint32_t level :1;
+	uint32_t us :31;
+} gpio_pulse_t;
+
+// precompiled edge timeline, played against absolute deadlines
+#define GPIO_PROGRAM_SIZE	1024
+
+typedef struct gpio_program_t {
+	int count;								// number of pulses
+	uint32_t duration;						// sum of all pulses
+	uint32_t pause;							// idle time after the last pulse
+	gpio_pulse_t pulses[GPIO_PROGRAM_SIZE];
+} gpio_program_t;
+
+// declarative pulse protocol, drives the encoder here and the receiver's decoders
+#define GPIO_SYMBOL_SIZE	4
+
+typedef struct gpio_protocol_t {
+	int bits;								// message bits, sent MSB first
+	int repeat;								// frames per transmission
+	uint16_t sync[2];						// sync high + low
+	uint16_t zero[GPIO_SYMBOL_SIZE];		// alternating high + low pulses of a 0 bit, 0 terminated
+	uint16_t one[GPIO_SYMBOL_SIZE];			// alternating high + low pulses of a 1 bit, 0 terminated
+	uint16_t tail[2];						// optional clock high + low after the last bit
+	uint32_t gap;							// low after each frame
+	uint32_t pause;							// idle time after the last frame
+	int level;								// decoder: level of the measured pulses
+	int symbols;							// decoder: measured pulses per bit, the first one decides, the others are clock
+	uint16_t threshold;						// decoder: measured pulses longer than this are a 1
+	uint16_t tolerance;						// decoder: accepted deviation of the sync low
+} gpio_protocol_t;
+
+// resolved GPIO pin with cached register pointers
+typedef struct gpio_pin_t {
+	int pin;
+	uint32_t bit;
+	volatile uint32_t *cfg;
+	volatile uint32_t *set;
+	volatile uint32_t *clr;
+	volatile uint32_t *lev;
+} gpio_pin_t;
+
+// handle based GPIO functions, resolve the pin once with gpio_pin() after gpio_init()
+int gpio_pin(gpio_pin_t *p, const char *name);
+int gpio_pin_configure(const gpio_pin_t *p, int function, int trigger, int initial);
+int gpio_pin_get(const gpio_pin_t *p);
+int gpio_pin_toggle(const gpio_pin_t *p);
+void gpio_pin_set(const gpio_pin_t *p, int value);
+void gpio_pin_print(const gpio_pin_t *p);
+
+// captured edge, timestamp in CLOCK_MONOTONIC microseconds and the level after the edge
+typedef struct gpio_edge_t {
+	uint32_t ts;
+	uint32_t level;
+} gpio_edge_t;
+
+// single producer / single consumer lock-free ring of captured edges, size must be a power of 2
+#define GPIO_RING_SIZE		4096
+
+typedef struct gpio_ring_t {
+	uint32_t head __attribute__((aligned(64)));	// written by producer only
+	uint32_t tail __attribute__((aligned(64)));	// written by consumer only
+	uint32_t dropped;								// edges lost because ring or kernel buffer was full
+	int efd;										// eventfd to wake up the consumer
+	gpio_edge_t edges[GPIO_RING_SIZE];
+} gpio_ring_t;
+
+typedef struct gpio_capture_t gpio_capture_t;
+
+// binary edge recording: header followed by 16 bit records, level in the top bit and the delta to the previous edge in us below
+#define GPIO_RECORD_MAGIC	0x45474445				// "EDGE"
+#define GPIO_RECORD_VERSION	1
+#define GPIO_RECORD_ESCAPE	0x7FFF					// delta does not fit, the next two records hold it, low half first
+
+typedef struct gpio_record_header_t {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t edges;								// number of edges, 0 when the recording was not closed
+	uint32_t start;								// timestamp of the first edge
+} gpio_record_header_t;
+
+typedef struct gpio_recorder_t gpio_recorder_t;
+
+// read side, the file is mmapped and decoded record by record
+typedef struct gpio_replay_t {
+	const gpio_record_header_t *header;
+	const uint16_t *next;
+	const uint16_t *end;
+	uint32_t ts;
+	size_t size;
+} gpio_replay_t;
+
+// edge capture functions
+void gpio_ring_init(gpio_ring_t *r);
+void gpio_ring_close(gpio_ring_t *r);
+void gpio_ring_notify(gpio_ring_t *r);
+int gpio_ring_wait(gpio_ring_t *r);
+int gpio_ring_push(gpio_ring_t *r, uint32_t ts, int level);
+int gpio_ring_pop(gpio_ring_t *r, gpio_edge_t *e);
+uint32_t gpio_ring_count(const gpio_ring_t *r);
+gpio_capture_t* gpio_capture_start(const char *name, gpio_ring_t *ring);
+void gpio_capture_stop(gpio_capture_t *c);
+gpio_recorder_t* gpio_record_start(const char *path);
+int gpio_record_edge(gpio_recorder_t *r, const gpio_edge_t *e);
+void gpio_record_stop(gpio_recorder_t *r);
+int gpio_replay_open(gpio_replay_t *r, const char *path);
+int gpio_replay_next(gpio_replay_t *r, gpio_edge_t *e);
+void gpio_replay_rewind(gpio_replay_t *r);
+void gpio_replay_close(gpio_replay_t *r);
+
+// generic GPIO functions, wrappers resolving the pin name on each call
 int gpio_init(void);
 int gpio_configure(const char *name, int function, int trigger, int initial);
 int gpio_get(const char *name);
@@ -28,10 +140,31 @@ void gpio_set(const char *name, int value);
 void gpio_print(const char *name);
 void gpio_close(void);
 
+// delay strategies: pure spinning, relative usleep + spin, absolute clock_nanosleep + learned spin guard
+#define GPIO_DELAY_SPIN		0
+#define GPIO_DELAY_USLEEP	1
+#define GPIO_DELAY_HYBRID	2
+
 // generic timer functions
 uint32_t gpio_micros();
 uint32_t gpio_micros_since(uint32_t *when);
 void gpio_delay_micros(uint32_t us);
+void gpio_delay_until(uint32_t deadline);
+void gpio_delay_strategy(int strategy);
+uint32_t gpio_delay_latency();
+void gpio_trace(int32_t *errors);
+
+// pulse program functions
+void gpio_program_clear(gpio_program_t *p);
+int gpio_program_add(gpio_program_t *p, int level, uint32_t us);
+void gpio_program_print(const gpio_program_t *p);
+void gpio_play(const gpio_pin_t *pin, const gpio_program_t *p);
+
+// application-specific pulse program compilers
+int gpio_protocol_compile(gpio_program_t *p, const gpio_protocol_t *proto, uint32_t message);
+int gpio_flamingo_v1_compile(gpio_program_t *p, uint32_t message, int bits, int repeat, int pulse);
+int gpio_flamingo_v2_compile(gpio_program_t *p, uint32_t message, int bits, int repeat, int phi, int plo);
+int gpio_lirc_compile(gpio_program_t *p, uint32_t message);
 
 // application-specific functions
 void gpio_flamingo_v1(const char *name, uint32_t message, int bits, int repeat, int pulse);
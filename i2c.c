@@ -0,0 +1,188 @@
+/*
+ * combined I2C transactions via I2C_RDWR
+ *
+ * Each call is a single ioctl addressing the device in the message itself, so
+ * neither I2C_SLAVE nor one smbus ioctl per register is needed. Built with
+ * I2C_SIM the transfers go to a model of the BH1750 and BMP085 on a 100kHz bus.
+ *
+ * (C) Copyright 2022 Heiko Jehmlich <hje@jecons.de>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+#include "i2c.h"
+#include "sensors.h"
+#include "utils.h"
+
+// maximum messages of i2c_commands()
+#define I2C_COMMANDS		8
+
+static i2c_stats_t stats;
+
+#ifdef I2C_SIM
+// datasheet example calibration and raw values
+static const uint8_t BMP085_CALIBRATION[22] = { 0x01, 0x98, 0xFF, 0xB8, 0xC7, 0xD1, 0x7F, 0xE5, 0x7F, 0xF5, 0x5A, 0x71, 0x18, 0x2E, 0x00, 0x04,
+		0x80, 0x00, 0xDD, 0xF9, 0x0B, 0x34 };
+#define SIM_UT				27898
+#define SIM_UP				34330					// about 1013 hPa
+
+static uint8_t bmp085_regs[0x100], bmp085_reg;
+static uint8_t bh1750_mode, bh1750_mtreg = 69;
+
+// 100kHz, start + address byte + data bytes with ack + stop
+static uint32_t sim_bus_time(const struct i2c_msg *m) {
+	return 10 * (2 + 9 * (1 + m->len));
+}
+
+// light level from the environment, 100 lx by default
+static double sim_lux() {
+	const char *lux = getenv("I2C_SIM_LUX");
+	return lux ? atof(lux) : 100.0;
+}
+
+static void sim_bmp085(struct i2c_msg *m) {
+	if (m->flags & I2C_M_RD) {
+		memcpy(m->buf, &bmp085_regs[bmp085_reg], m->len);
+		return;
+	}
+
+	bmp085_reg = m->buf[0];
+	if (m->len < 2 || bmp085_reg != 0xF4)
+		return;
+
+	// conversion results are available immediately, oversampling adds resolution to the left aligned 19 bits
+	uint32_t v = m->buf[1] == 0x2E ? SIM_UT << 8 : SIM_UP << 8;
+	bmp085_regs[0xF6] = v >> 16;
+	bmp085_regs[0xF7] = v >> 8;
+	bmp085_regs[0xF8] = v;
+}
+
+static void sim_bh1750(struct i2c_msg *m) {
+	if (m->flags & I2C_M_RD) {
+		double counts = sim_lux() * 1.2 * bh1750_mtreg / 69;
+		if (bh1750_mode == BH1750_CHM2 || bh1750_mode == BH1750_OTHM2)
+			counts *= 2;
+		if (bh1750_mode == BH1750_CLM || bh1750_mode == BH1750_OTLM)
+			counts /= 4;
+		uint16_t raw = counts > UINT16_MAX ? UINT16_MAX : counts;
+		m->buf[0] = raw >> 8;
+		if (m->len > 1)
+			m->buf[1] = raw;
+		return;
+	}
+
+	uint8_t c = m->buf[0];
+	if ((c & 0xF8) == 0x40)
+		bh1750_mtreg = (bh1750_mtreg & 0x1F) | (c & 0x07) << 5;
+	else if ((c & 0xE0) == 0x60)
+		bh1750_mtreg = (bh1750_mtreg & 0xE0) | (c & 0x1F);
+	else if (c & 0x30)
+		bh1750_mode = c;
+}
+
+static int transfer(int fd, struct i2c_msg *msgs, int count) {
+	if (bmp085_regs[0xAA] == 0)
+		memcpy(&bmp085_regs[0xAA], BMP085_CALIBRATION, sizeof(BMP085_CALIBRATION));
+
+	stats.syscalls++;
+	for (struct i2c_msg *m = msgs; m < msgs + count; m++) {
+		if (m->addr == BMP085_ADDR)
+			sim_bmp085(m);
+		else if (m->addr == BH1750_ADDR)
+			sim_bh1750(m);
+		else
+			return -1;
+		stats.messages++;
+		stats.bytes += m->len;
+		stats.bus += sim_bus_time(m);
+	}
+	return count;
+}
+
+int i2c_open(const char *bus) {
+	return open("/dev/null", O_RDWR);
+}
+#else
+static int transfer(int fd, struct i2c_msg *msgs, int count) {
+	struct i2c_rdwr_ioctl_data data = { msgs, count };
+	uint32_t start = mono_micros();
+
+	int ret = ioctl(fd, I2C_RDWR, &data);
+	stats.syscalls++;
+	stats.bus += mono_micros() - start;
+	if (ret < 0)
+		return ret;
+
+	for (struct i2c_msg *m = msgs; m < msgs + count; m++)
+		stats.bytes += m->len;
+	stats.messages += count;
+	return ret;
+}
+
+int i2c_open(const char *bus) {
+	return open(bus, O_RDWR);
+}
+#endif
+
+void i2c_close(int fd) {
+	if (fd >= 0)
+		close(fd);
+}
+
+int i2c_write(int fd, uint8_t addr, const uint8_t *data, int len) {
+	struct i2c_msg m = { addr, 0, len, (uint8_t*) data };
+
+	return transfer(fd, &m, 1) == 1 ? 0 : -1;
+}
+
+int i2c_write_reg(int fd, uint8_t addr, uint8_t reg, uint8_t value) {
+	uint8_t buf[2] = { reg, value };
+
+	return i2c_write(fd, addr, buf, 2);
+}
+
+// single byte commands, each in its own message
+int i2c_commands(int fd, uint8_t addr, const uint8_t *commands, int count) {
+	struct i2c_msg m[I2C_COMMANDS];
+
+	if (count > I2C_COMMANDS)
+		return -1;
+
+	for (int i = 0; i < count; i++) {
+		m[i].addr = addr;
+		m[i].flags = 0;
+		m[i].len = 1;
+		m[i].buf = (uint8_t*) &commands[i];
+	}
+	return transfer(fd, m, count) == count ? 0 : -1;
+}
+
+int i2c_read(int fd, uint8_t addr, uint8_t *data, int len) {
+	struct i2c_msg m = { addr, I2C_M_RD, len, data };
+
+	return transfer(fd, &m, 1) == 1 ? 0 : -1;
+}
+
+int i2c_read_reg(int fd, uint8_t addr, uint8_t reg, uint8_t *data, int len) {
+	struct i2c_msg m[2] = { { addr, 0, 1, &reg }, { addr, I2C_M_RD, len, data } };
+
+	return transfer(fd, m, 2) == 2 ? 0 : -1;
+}
+
+const i2c_stats_t* i2c_stats() {
+	return &stats;
+}
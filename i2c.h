@@ -0,0 +1,30 @@
+/*
+ * combined I2C transactions via I2C_RDWR
+ *
+ * (C) Copyright 2022 Heiko Jehmlich <hje@jecons.de>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ */
+
+// transfer counters, the difference of two snapshots gives the cost of a measurement cycle
+typedef struct i2c_stats_t {
+	uint32_t syscalls;						// ioctls issued
+	uint32_t messages;						// i2c messages on the bus
+	uint32_t bytes;							// data bytes without address bytes
+	uint32_t bus;							// us spent in transfers
+} i2c_stats_t;
+
+int i2c_open(const char *bus);
+void i2c_close(int fd);
+
+// each function is a single ioctl, register reads use a repeated start between the write and the read message
+int i2c_write(int fd, uint8_t addr, const uint8_t *data, int len);
+int i2c_write_reg(int fd, uint8_t addr, uint8_t reg, uint8_t value);
+int i2c_commands(int fd, uint8_t addr, const uint8_t *commands, int count);
+int i2c_read(int fd, uint8_t addr, uint8_t *data, int len);
+int i2c_read_reg(int fd, uint8_t addr, uint8_t reg, uint8_t *data, int len);
+
+const i2c_stats_t* i2c_stats();
@@ -2,10 +2,16 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <signal.h>
 #include <unistd.h>
+#include <ctype.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 #include "utils.h"
 #include "flamingo.h"
@@ -15,12 +21,145 @@
 #include "gpio.h"
 #include "mcp.h"
 
+// seconds a control client may stay silent before it is disconnected
+#define CONTROL_TIMEOUT		5
+
 static mcp_config_t *cfg;
 
+static int control_fd = -1;
+static pthread_t thread_control;
+
 static void sig_handler(int signo) {
 	xlog("MCP received signal %d", signo);
 }
 
+static void flamingo_handler(const flamingo_frame_t *f) {
+	if (f->protocol == FLAMINGO_RC3)
+		xlog("flamingo received rc3 %s", f->multibit);
+	else if (!f->valid)
+		xlog("flamingo received rc%d 0x%08x, not from our remotes", f->protocol, f->code);
+	else
+		xlog("flamingo received rc%d 0x%08x xmitter=0x%04x channel=%d command=%d", f->protocol, f->code, f->xmitter, f->channel, f->command);
+}
+
+// receiver and transmitter counters as key=value pairs on one line
+static int control_stats(char *reply, int size) {
+	const flamingo_stats_t *s = flamingo_stats();
+	int n = snprintf(reply, size, "ok frames=%u overwritten=%u dropped=%u repeats=%u unknown=%u", s->frames, s->overwritten, s->dropped,
+			s->repeats, s->unknown);
+	for (int i = 0; i < FLAMINGO_RECEIVERS; i++)
+		n += snprintf(reply + n, size - n, " received%d=%u", i, s->received[i]);
+	n += snprintf(reply + n, size - n, " transmitted=%u superseded=%u throttled=%u airtime=%u backoffs=%u collisions=%u\n", s->transmitted,
+			s->superseded, s->throttled, s->airtime, s->backoffs, s->collisions);
+	return n;
+}
+
+// flamingo <remote> <channel> <command> <rolling>
+// stats
+static void control_command(int fd, const char *line) {
+	char reply[512], channel;
+	int remote, command, rolling, n;
+
+	if (!strcmp(line, "stats"))
+		n = control_stats(reply, sizeof(reply));
+	else if (sscanf(line, "flamingo %d %c %d %d", &remote, &channel, &command, &rolling) != 4)
+		n = snprintf(reply, sizeof(reply), "error unknown command\n");
+	else {
+		int id = flamingo_submit_FA500(remote, toupper(channel), command, rolling, FLAMINGO_PRIO_HIGH, NULL, NULL);
+		if (id < 0)
+			n = snprintf(reply, sizeof(reply), "error rejected\n");
+		else
+			n = snprintf(reply, sizeof(reply), "ok %d\n", id);
+	}
+	// client may already be gone, that must not raise SIGPIPE in the daemon
+	if (send(fd, reply, n, MSG_NOSIGNAL) != n)
+		xlog("control client did not take the reply: %s", strerror(errno));
+}
+
+// control socket, clients get an answer as soon as the command is queued
+static void* control_loop(void *arg) {
+	char buf[256];
+
+	if (pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL)) {
+		xlog("Error setting pthread_setcancelstate");
+		return (void*) 0;
+	}
+
+	while (1) {
+		int fd = accept(control_fd, NULL, NULL);
+		if (fd < 0)
+			continue;
+
+		// clients are served one after the other, an idle one must not block the others
+		struct timeval tv = { CONTROL_TIMEOUT, 0 };
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+		setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+		int len = 0, n;
+		while ((n = read(fd, buf + len, sizeof(buf) - 1 - len)) > 0) {
+			len += n;
+			buf[len] = '\0';
+
+			char *line = buf, *eol;
+			while ((eol = strchr(line, '\n')) != NULL) {
+				*eol = '\0';
+				control_command(fd, line);
+				line = eol + 1;
+			}
+
+			// keep an incomplete line, drop an overlong one
+			len = strlen(line);
+			memmove(buf, line, len + 1);
+			if (len == sizeof(buf) - 1)
+				len = 0;
+		}
+		close(fd);
+	}
+	return (void*) 0;
+}
+
+static int control_init() {
+	struct sockaddr_un addr;
+
+	control_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (control_fd < 0)
+		return -1;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, FLAMINGO_SOCKET, sizeof(addr.sun_path) - 1);
+	unlink(FLAMINGO_SOCKET);
+	// daemonize() cleared the umask, restrict to owner and group before anybody can connect
+	if (bind(control_fd, (struct sockaddr*) &addr, sizeof(addr)) < 0 || chmod(FLAMINGO_SOCKET, 0660) < 0 || listen(control_fd, 4) < 0) {
+		xlog("control socket %s failed", FLAMINGO_SOCKET);
+		close(control_fd);
+		control_fd = -1;
+		return -2;
+	}
+
+	if (pthread_create(&thread_control, NULL, &control_loop, NULL)) {
+		xlog("Error creating thread");
+		return -3;
+	}
+	return 0;
+}
+
+static void control_close() {
+	if (thread_control) {
+		if (pthread_cancel(thread_control))
+			xlog("Error canceling thread");
+		if (pthread_join(thread_control, NULL))
+			xlog("Error joining thread");
+		thread_control = 0;
+	}
+
+	if (control_fd >= 0) {
+		close(control_fd);
+		unlink(FLAMINGO_SOCKET);
+	}
+	control_fd = -1;
+}
+
 static void daemonize() {
 	pid_t pid;
 
@@ -62,7 +201,7 @@ static void mcp_init() {
 	if (gpio_init() < 0)
 		exit(EXIT_FAILURE);
 
-	if (flamingo_init() < 0)
+	if (flamingo_init(&flamingo_handler) < 0)
 		exit(EXIT_FAILURE);
 
 	if (sensors_init() < 0)
@@ -74,10 +213,14 @@ static void mcp_init() {
 	if (xmas_init() < 0)
 		exit(EXIT_FAILURE);
 
+	if (control_init() < 0)
+		exit(EXIT_FAILURE);
+
 	xlog("all modules initialized");
 }
 
 static void mcp_close() {
+	control_close();
 	xmas_close();
 	webcam_close();
 	sensors_close();
@@ -122,6 +265,9 @@ int main(int argc, char **argv) {
 		exit(EXIT_FAILURE);
 	}
 
+	// peers closing sockets early are handled by the write() results
+	signal(SIGPIPE, SIG_IGN);
+
 	// initialize modules
 	mcp_init();
 
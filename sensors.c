@@ -4,36 +4,79 @@
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <time.h>
 #include <math.h>
 #include <pthread.h>
-#include <sys/ioctl.h>
-#include <linux/i2c-dev.h>
 
 #include <mqtt.h>
 #include <posix_sockets.h>
 
 #include "sensors.h"
-#include "smbus.h"
+#include "i2c.h"
 #include "utils.h"
 
-#define SWAP(X) ((X<<8) & 0xFF00) | ((X>>8) & 0xFF)
+// non-blocking acquisition, each step starts or collects a conversion and returns the ms until the next step is due, 0 when done
+typedef struct sensor_t {
+	const char *name;
+	int (*step)(int state);
+	int interval;
+	int state;								// -1 between measurements
+	uint32_t start;
+	uint32_t due;
+} sensor_t;
+
+// min/max/sum of one period, updated with each sample
+typedef struct rollup_t {
+	time_t start;
+	uint32_t count;
+	float min;
+	float max;
+	double sum;
+} rollup_t;
+
+typedef struct rollups_t {
+	int period;
+	int count;								// periods completed so far
+	rollup_t current;
+	rollup_t history[SENSORS_ROLLUPS];
+} rollups_t;
+
+typedef struct series_t {
+	int head;								// samples added so far
+	time_t ts[SENSORS_SAMPLES];
+	float values[SENSORS_SAMPLES];
+	rollups_t minutes;
+	rollups_t hours;
+} series_t;
 
 // TODO config
+#ifndef I2C_SIM
 static const char *clientid = "picam-mcp";
 static const char *addr = "tron";
 static const char *port = "1883";
+#endif
 static const char *topic = "sensor";
 
 static pthread_t thread_sensors;
 static int i2cfd;
 static int mqttfd;
+#ifndef I2C_SIM
 static struct mqtt_client client;
 static uint8_t sendbuf[2048];
 static uint8_t recvbuf[1024];
+#endif
+
+static series_t series[SENSORS_SERIES];
+static pthread_mutex_t series_lock = PTHREAD_MUTEX_INITIALIZER;
 
 static void* sensors_loop(void *arg);
 
-sensors_t *sensors;
+// written by the sensors thread only, published to the readers with sensors_publish()
+static sensors_t *sensors;
+
+// two copies of the last published state, readers take the one the writer is not touching
+static sensors_t snapshots[2];
+static uint32_t snapshot_seq;
 
 // bisher gefühlt bei 100 Lux (19:55)
 // Straßenlampe Eisenstraße 0x40 = XX Lux
@@ -41,50 +84,212 @@ sensors_t *sensors;
 // Kamera aus bei 0x02 = 1 Lux (20:22)
 // 0x00 (20:25) aber noch deutlich hell am Westhorizont
 
-// https://forums.raspberrypi.com/viewtopic.php?t=38023
-static void read_bh1750() {
-	__u8 buf[2];
+// latch style seqlock: switch readers to copy 1, update copy 0, switch them back and update copy 1
+static void sensors_publish() {
+	uint32_t seq = snapshot_seq;
+
+	__atomic_store_n(&snapshot_seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	memcpy(&snapshots[0], sensors, sizeof(sensors_t));
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	__atomic_store_n(&snapshot_seq, seq + 2, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	memcpy(&snapshots[1], sensors, sizeof(sensors_t));
+}
 
-	if (ioctl(i2cfd, I2C_SLAVE, BH1750_ADDR) < 0)
-		return;
+// consistent copy of all readings, never blocks and only repeats when the writer published meanwhile
+void sensors_snapshot(sensors_t *snapshot) {
+	uint32_t seq;
 
-	// powerup
-	i2c_smbus_write_byte(i2cfd, BH1750_POWERON);
+	do {
+		seq = __atomic_load_n(&snapshot_seq, __ATOMIC_ACQUIRE);
+		memcpy(snapshot, &snapshots[seq & 1], sizeof(sensors_t));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while (seq != __atomic_load_n(&snapshot_seq, __ATOMIC_RELAXED));
+}
 
-	// continuous high mode (resolution 1lx)
-	i2c_smbus_write_byte(i2cfd, BH1750_CHM);
-	msleep(180);
-	if (read(i2cfd, buf, 2) != 2)
-		return;
-	sensors->bh1750_raw = buf[0] << 8 | buf[1];
+// move the running period to the history when it has ended
+static int rollup_close(rollups_t *r, time_t now) {
+	if (!r->current.count || now < r->current.start + r->period)
+		return 0;
+
+	r->history[r->count++ % SENSORS_ROLLUPS] = r->current;
+	r->current.count = 0;
+	return 1;
+}
+
+static void rollup_add(rollups_t *r, time_t now, float value) {
+	rollup_close(r, now);
+
+	rollup_t *c = &r->current;
+	if (!c->count) {
+		c->start = now - now % r->period;
+		c->min = c->max = value;
+		c->sum = 0;
+	}
+	if (value < c->min)
+		c->min = value;
+	if (value > c->max)
+		c->max = value;
+	c->sum += value;
+	c->count++;
+}
+
+static void series_add(int id, float value) {
+	series_t *s = &series[id];
+	time_t now = time(NULL);
+
+	pthread_mutex_lock(&series_lock);
+	s->ts[s->head % SENSORS_SAMPLES] = now;
+	s->values[s->head % SENSORS_SAMPLES] = value;
+	s->head++;
+	rollup_add(&s->minutes, now, value);
+	rollup_add(&s->hours, now, value);
+	pthread_mutex_unlock(&series_lock);
+}
+
+// close ended periods without waiting for the next sample, returns the number of minutes completed since the last call
+static int series_tick(time_t now) {
+	static int seen;
+	int minutes = 0;
+
+	pthread_mutex_lock(&series_lock);
+	for (series_t *s = series; s < series + SENSORS_SERIES; s++) {
+		rollup_close(&s->minutes, now);
+		rollup_close(&s->hours, now);
+		minutes += s->minutes.count;
+	}
+	pthread_mutex_unlock(&series_lock);
+
+	minutes -= seen;
+	seen += minutes;
+	return minutes;
+}
+
+// completed minute or hour, ago 0 is the latest one
+int sensors_rollup(int id, int period, int ago, sensors_rollup_t *rollup) {
+	if (id < 0 || id >= SENSORS_SERIES || ago < 0 || ago >= SENSORS_ROLLUPS)
+		return -1;
+
+	pthread_mutex_lock(&series_lock);
+	rollups_t *r = period == SENSORS_HOUR ? &series[id].hours : &series[id].minutes;
+	if (ago >= r->count) {
+		pthread_mutex_unlock(&series_lock);
+		return -1;
+	}
+	rollup_t *h = &r->history[(r->count - 1 - ago) % SENSORS_ROLLUPS];
+	rollup->start = h->start;
+	rollup->count = h->count;
+	rollup->min = h->min;
+	rollup->max = h->max;
+	rollup->mean = h->sum / h->count;
+	pthread_mutex_unlock(&series_lock);
+	return 0;
+}
+
+// latest raw samples, newest first, returns the number copied
+int sensors_samples(int id, time_t *ts, float *values, int count) {
+	if (id < 0 || id >= SENSORS_SERIES)
+		return -1;
+
+	pthread_mutex_lock(&series_lock);
+	series_t *s = &series[id];
+	int n = s->head < SENSORS_SAMPLES ? s->head : SENSORS_SAMPLES;
+	if (count > n)
+		count = n;
+	for (int i = 0; i < count; i++) {
+		int j = (s->head - 1 - i) % SENSORS_SAMPLES;
+		ts[i] = s->ts[j];
+		values[i] = s->values[j];
+	}
+	pthread_mutex_unlock(&series_lock);
+	return count;
+}
+
+// BH1750 auto ranging, enough counts for a fine resolution at dusk and a short measurement time at daylight
+#define BH1750_COUNTS		1024
+#define BH1750_HEADROOM		32768
+
+// sensitivity and mode for the next measurement, derived from the previous one
+static int bh1750_mtreg = BH1750_MTREG_DEF, bh1750_mode = BH1750_OTHM2;
 
-	// continuous high mode 2 (resolution 0.5lx)
-	i2c_smbus_write_byte(i2cfd, BH1750_CHM2);
-	msleep(180);
-	if (read(i2cfd, buf, 2) != 2)
+static void bh1750_range(double raw2) {
+	// high resolution mode 2 counts per MTreg step
+	double step = raw2 / BH1750_MTREG_DEF;
+
+	// too bright for mode 2 even at the lowest sensitivity, mode 1 halves the counts
+	if (step * BH1750_MTREG_MIN > BH1750_HEADROOM) {
+		bh1750_mode = BH1750_OTHM;
+		bh1750_mtreg = BH1750_MTREG_MIN;
 		return;
-	sensors->bh1750_raw2 = buf[0] << 8 | buf[1];
+	}
+
+	bh1750_mode = BH1750_OTHM2;
+	bh1750_mtreg = step > 0 ? BH1750_COUNTS / step : BH1750_MTREG_MAX;
+	if (bh1750_mtreg < BH1750_MTREG_MIN)
+		bh1750_mtreg = BH1750_MTREG_MIN;
+	if (bh1750_mtreg > BH1750_MTREG_MAX)
+		bh1750_mtreg = BH1750_MTREG_MAX;
+}
 
-	// sleep
-	i2c_smbus_write_byte(i2cfd, BH1750_POWERDOWN);
+// powerup, set the measurement time and start a one time measurement, the sensor powers down afterwards
+static int bh1750_start() {
+	uint8_t buf[4] = { BH1750_POWERON, BH1750_MTREG_HIGH | bh1750_mtreg >> 5, BH1750_MTREG_LOW | (bh1750_mtreg & 0x1F), bh1750_mode };
 
-	if (sensors->bh1750_raw2 == UINT16_MAX)
-		sensors->bh1750_lux = sensors->bh1750_raw / 1.2;
-	else
-		sensors->bh1750_lux = sensors->bh1750_raw2 / 2.4;
+	if (i2c_commands(i2cfd, BH1750_ADDR, buf, sizeof(buf)) < 0) {
+		sensors->bh1750_valid = 0;
+		return 0;
+	}
 
+	// max. 180ms at the default measurement time
+	return 180 * bh1750_mtreg / BH1750_MTREG_DEF + 1;
+}
+
+// https://forums.raspberrypi.com/viewtopic.php?t=38023
+static int read_bh1750(int state) {
+	uint8_t buf[2];
+
+	// the flag is only cleared on failures, snapshots published while integrating keep the previous state
+	if (state == 0)
+		return bh1750_start();
+
+	if (i2c_read(i2cfd, BH1750_ADDR, buf, 2) < 0) {
+		sensors->bh1750_valid = 0;
+		return 0;
+	}
+	unsigned int counts = buf[0] << 8 | buf[1];
+
+	// saturated, e.g. sun coming out behind a cloud: measure again at the lowest sensitivity
+	if (counts == UINT16_MAX && state == 1 && bh1750_mode != BH1750_OTHM) {
+		bh1750_range(UINT16_MAX * BH1750_MTREG_DEF);
+		return bh1750_start();
+	}
+
+	// mode 2 counts at the default measurement time, what the continuous mode used to deliver
+	double raw2 = (double) counts * BH1750_MTREG_DEF / bh1750_mtreg;
+	if (bh1750_mode == BH1750_OTHM)
+		raw2 *= 2;
+
+	sensors->bh1750_ts = time(NULL);
+	sensors->bh1750_valid = 1;
+	sensors->bh1750_mtreg = bh1750_mtreg;
+	sensors->bh1750_raw2 = raw2 > UINT16_MAX ? UINT16_MAX : raw2;
+	sensors->bh1750_raw = raw2 / 2 > UINT16_MAX ? UINT16_MAX : raw2 / 2;
+	sensors->bh1750_lux = raw2 / 2.4;
 	sensors->bh1750_prc = (sqrt(sensors->bh1750_raw) * 100) / UINT8_MAX;
+	series_add(SENSORS_LUX, raw2 / 2.4);
+
+	bh1750_range(raw2);
+	return 0;
 }
 
 // https://forums.raspberrypi.com/viewtopic.php?t=16968
-static void read_bmp085() {
-	__u8 buf[3];
+static int read_bmp085(int state) {
+	static int b5;
+	uint8_t buf[3];
 	int x1, x2, x3, b3, b6, p;
 	unsigned int b4, b7;
 
-	if (ioctl(i2cfd, I2C_SLAVE, BMP085_ADDR) < 0)
-		return;
-
 	short int ac1 = sensors->bmp085_ac1;
 	short int ac2 = sensors->bmp085_ac2;
 	short int ac3 = sensors->bmp085_ac3;
@@ -97,19 +302,40 @@ static void read_bmp085() {
 	short int mc = sensors->bmp085_mc;
 	short int md = sensors->bmp085_md;
 
-	// temperature
-	i2c_smbus_write_byte_data(i2cfd, 0xF4, 0x2E);
-	msleep(5);
-	sensors->bmp085_utemp = SWAP(i2c_smbus_read_word_data(i2cfd, 0xF6));
-	x1 = (((int) sensors->bmp085_utemp - (int) ac6) * (int) ac5) >> 15;
-	x2 = ((int) mc << 11) / (x1 + md);
-	int b5 = x1 + x2;
-	sensors->bmp085_temp = ((b5 + 8) >> 4) / 10.0;
+	switch (state) {
+	case 0:
+		// start temperature conversion, the flag is only cleared on failures
+		if (i2c_write_reg(i2cfd, BMP085_ADDR, 0xF4, 0x2E) < 0) {
+			sensors->bmp085_valid = 0;
+			return 0;
+		}
+		return 5;
+
+	case 1:
+		if (i2c_read_reg(i2cfd, BMP085_ADDR, 0xF6, buf, 2) < 0) {
+			sensors->bmp085_valid = 0;
+			return 0;
+		}
+		sensors->bmp085_utemp = buf[0] << 8 | buf[1];
+		x1 = (((int) sensors->bmp085_utemp - (int) ac6) * (int) ac5) >> 15;
+		x2 = ((int) mc << 11) / (x1 + md);
+		b5 = x1 + x2;
+		sensors->bmp085_temp = ((b5 + 8) >> 4) / 10.0;
+		series_add(SENSORS_TEMP, sensors->bmp085_temp);
+
+		// start pressure conversion
+		if (i2c_write_reg(i2cfd, BMP085_ADDR, 0xF4, 0x34 + (BMP085_OVERSAMPLE << 6)) < 0) {
+			sensors->bmp085_valid = 0;
+			return 0;
+		}
+		return 2 + (3 << BMP085_OVERSAMPLE);
+	}
 
 	// pressure
-	i2c_smbus_write_byte_data(i2cfd, 0xF4, 0x34 + (BMP085_OVERSAMPLE << 6));
-	msleep(2 + (3 << BMP085_OVERSAMPLE));
-	i2c_smbus_read_i2c_block_data(i2cfd, 0xF6, 3, buf);
+	if (i2c_read_reg(i2cfd, BMP085_ADDR, 0xF6, buf, 3) < 0) {
+		sensors->bmp085_valid = 0;
+		return 0;
+	}
 	sensors->bmp085_ubaro = (((unsigned int) buf[0] << 16) | ((unsigned int) buf[1] << 8) | (unsigned int) buf[2]) >> (8 - BMP085_OVERSAMPLE);
 	b6 = b5 - 4000;
 	x1 = (b2 * (b6 * b6) >> 12) >> 11;
@@ -130,27 +356,90 @@ static void read_bmp085() {
 	x2 = (-7357 * p) >> 16;
 	p += (x1 + x2 + 3791) >> 4;
 	sensors->bmp085_baro = p / 100.0;
+	sensors->bmp085_ts = time(NULL);
+	sensors->bmp085_valid = 1;
+	series_add(SENSORS_BARO, sensors->bmp085_baro);
+	return 0;
 }
 
-// read BMP085 calibration data
+static sensor_t sensor_list[] = {
+		{ BH1750, &read_bh1750, BH1750_INTERVAL },
+		{ BMP085, &read_bmp085, BMP085_INTERVAL },
+};
+
+static void sensors_schedule() {
+	uint32_t now = mono_millis();
+
+	for (sensor_t *s = sensor_list; s < sensor_list + ARRAY_SIZE(sensor_list); s++) {
+		s->state = -1;
+		s->due = now;
+	}
+}
+
+// run the step due first, so conversions of different sensors overlap, returns the sensor when it completed a measurement
+static sensor_t* sensors_step() {
+	sensor_t *next = sensor_list;
+
+	for (sensor_t *s = sensor_list; s < sensor_list + ARRAY_SIZE(sensor_list); s++)
+		if ((int32_t) (s->due - next->due) < 0)
+			next = s;
+
+	int32_t wait = next->due - mono_millis();
+	if (wait > 0)
+		msleep(wait);
+
+	if (next->state < 0) {
+		next->state = 0;
+		next->start = mono_millis();
+	}
+
+	int ms = (next->step)(next->state);
+	if (ms > 0) {
+		next->state++;
+		next->due = mono_millis() + ms;
+		return NULL;
+	}
+
+	sensors_publish();
+
+	// next measurement at the sensor's rate, right away when this one took longer
+	next->state = -1;
+	next->due = next->start + next->interval;
+	if ((int32_t) (next->due - mono_millis()) < 0)
+		next->due = mono_millis();
+	return next;
+}
+
+// read BMP085 calibration data, 11 big endian words in one burst
 static void init_bmp085() {
-	if (ioctl(i2cfd, I2C_SLAVE, BMP085_ADDR) < 0)
+	uint8_t buf[22];
+
+	if (i2c_read_reg(i2cfd, BMP085_ADDR, 0xAA, buf, sizeof(buf)) < 0)
 		return;
 
-	sensors->bmp085_ac1 = SWAP(i2c_smbus_read_word_data(i2cfd, 0xAA));
-	sensors->bmp085_ac2 = SWAP(i2c_smbus_read_word_data(i2cfd, 0xAC));
-	sensors->bmp085_ac3 = SWAP(i2c_smbus_read_word_data(i2cfd, 0xAE));
-	sensors->bmp085_ac4 = SWAP(i2c_smbus_read_word_data(i2cfd, 0xB0));
-	sensors->bmp085_ac5 = SWAP(i2c_smbus_read_word_data(i2cfd, 0xB2));
-	sensors->bmp085_ac6 = SWAP(i2c_smbus_read_word_data(i2cfd, 0xB4));
-	sensors->bmp085_b1 = SWAP(i2c_smbus_read_word_data(i2cfd, 0xB6));
-	sensors->bmp085_b2 = SWAP(i2c_smbus_read_word_data(i2cfd, 0xB8));
-	sensors->bmp085_mb = SWAP(i2c_smbus_read_word_data(i2cfd, 0xBA));
-	sensors->bmp085_mc = SWAP(i2c_smbus_read_word_data(i2cfd, 0xBC));
-	sensors->bmp085_md = SWAP(i2c_smbus_read_word_data(i2cfd, 0xBE));
+	sensors->bmp085_ac1 = (int16_t) (buf[0] << 8 | buf[1]);
+	sensors->bmp085_ac2 = (int16_t) (buf[2] << 8 | buf[3]);
+	sensors->bmp085_ac3 = (int16_t) (buf[4] << 8 | buf[5]);
+	sensors->bmp085_ac4 = buf[6] << 8 | buf[7];
+	sensors->bmp085_ac5 = buf[8] << 8 | buf[9];
+	sensors->bmp085_ac6 = buf[10] << 8 | buf[11];
+	sensors->bmp085_b1 = (int16_t) (buf[12] << 8 | buf[13]);
+	sensors->bmp085_b2 = (int16_t) (buf[14] << 8 | buf[15]);
+	sensors->bmp085_mb = (int16_t) (buf[16] << 8 | buf[17]);
+	sensors->bmp085_mc = (int16_t) (buf[18] << 8 | buf[19]);
+	sensors->bmp085_md = (int16_t) (buf[20] << 8 | buf[21]);
 	xlog("read BMP085 calibration data");
 }
 
+#ifdef I2C_SIM
+// no broker and no libmqttc with the simulated bus, topics and values go to stdout
+static void init_mqtt() {
+}
+
+static void publish_mqtt_sensor(const char *sensor, const char *name, const char *value) {
+	printf("%s/%s/%s %s\n", topic, sensor, name, value);
+}
+#else
 static void init_mqtt() {
 	if (mqttfd > 0)
 		close(mqttfd);
@@ -176,6 +465,30 @@ static void publish_mqtt_sensor(const char *sensor, const char *name, const char
 	snprintf(subtopic, sizeof(subtopic), "%s/%s/%s", topic, sensor, name);
 	mqtt_publish(&client, subtopic, value, strlen(value), MQTT_PUBLISH_QOS_0);
 }
+#endif
+
+// mean, min and max of the last completed minute, the latest value until there is one
+static void publish_mqtt_rollup(const char *sensor, const char *name, int id, const char *fmt, float latest) {
+	sensors_rollup_t r;
+	char cname[32], cvalue[16];
+
+	if (sensors_rollup(id, SENSORS_MINUTE, 0, &r) < 0) {
+		snprintf(cvalue, sizeof(cvalue), fmt, latest);
+		publish_mqtt_sensor(sensor, name, cvalue);
+		return;
+	}
+
+	snprintf(cvalue, sizeof(cvalue), fmt, r.mean);
+	publish_mqtt_sensor(sensor, name, cvalue);
+
+	snprintf(cname, sizeof(cname), "%s_min", name);
+	snprintf(cvalue, sizeof(cvalue), fmt, r.min);
+	publish_mqtt_sensor(sensor, cname, cvalue);
+
+	snprintf(cname, sizeof(cname), "%s_max", name);
+	snprintf(cvalue, sizeof(cvalue), fmt, r.max);
+	publish_mqtt_sensor(sensor, cname, cvalue);
+}
 
 static void publish_mqtt() {
 	char cvalue[8];
@@ -185,6 +498,7 @@ static void publish_mqtt() {
 	if (mqttfd < 0)
 		return;
 
+#ifndef I2C_SIM
 	mqtt_sync(&client);
 	if (client.error != MQTT_OK) {
 		xlog("MQTT pre sync error: %s, trying reconnect on next publishing\n", mqtt_error_str(client.error));
@@ -192,6 +506,7 @@ static void publish_mqtt() {
 		mqttfd = -1;
 		return;
 	}
+#endif
 
 	snprintf(cvalue, 6, "%u", sensors->bh1750_raw);
 	publish_mqtt_sensor(BH1750, "lum_raw", cvalue);
@@ -199,21 +514,18 @@ static void publish_mqtt() {
 	snprintf(cvalue, 6, "%u", sensors->bh1750_raw2);
 	publish_mqtt_sensor(BH1750, "lum_raw2", cvalue);
 
-	snprintf(cvalue, 6, "%u", sensors->bh1750_lux);
-	publish_mqtt_sensor(BH1750, "lum_lux", cvalue);
-
 	snprintf(cvalue, 4, "%u", sensors->bh1750_prc);
 	publish_mqtt_sensor(BH1750, "lum_percent", cvalue);
 
-	snprintf(cvalue, 5, "%2.1f", sensors->bmp085_temp);
-	publish_mqtt_sensor(BMP085, "temp", cvalue);
-
-	snprintf(cvalue, 8, "%4.1f", sensors->bmp085_baro);
-	publish_mqtt_sensor(BMP085, "baro", cvalue);
+	publish_mqtt_rollup(BH1750, "lum_lux", SENSORS_LUX, "%.0f", sensors->bh1750_lux);
+	publish_mqtt_rollup(BMP085, "temp", SENSORS_TEMP, "%2.1f", sensors->bmp085_temp);
+	publish_mqtt_rollup(BMP085, "baro", SENSORS_BARO, "%4.1f", sensors->bmp085_baro);
 
+#ifndef I2C_SIM
 	mqtt_sync(&client);
 	if (client.error != MQTT_OK)
 		xlog("MQTT post sync error: %s\n", mqtt_error_str(client.error));
+#endif
 }
 
 static void write_sysfslike() {
@@ -242,8 +554,13 @@ int sensors_init() {
 	sensors = malloc(sizeof(*sensors));
 	ZERO(sensors);
 
+	for (series_t *s = series; s < series + SENSORS_SERIES; s++) {
+		s->minutes.period = SENSORS_MINUTE;
+		s->hours.period = SENSORS_HOUR;
+	}
+
 	// TODO config
-	i2cfd = open(I2CBUS, O_RDWR);
+	i2cfd = i2c_open(I2CBUS);
 	if (i2cfd < 0)
 		xlog("I2C BUS error");
 
@@ -266,8 +583,7 @@ void sensors_close() {
 			xlog("Error joining thread");
 	}
 
-	if (i2cfd > 0)
-		close(i2cfd);
+	i2c_close(i2cfd);
 
 	if (mqttfd > 0)
 		close(mqttfd);
@@ -279,27 +595,58 @@ static void* sensors_loop(void *arg) {
 		return (void*) 0;
 	}
 
+	// sample continuously, publish once per completed minute
+	sensors_schedule();
 	while (1) {
-		read_bh1750();
-		read_bmp085();
-		// write_sysfslike();
-		publish_mqtt();
-		sleep(60);
+		sensors_step();
+		if (series_tick(time(NULL))) {
+			// write_sysfslike();
+			publish_mqtt();
+		}
 	}
 }
 
 #ifdef SENSORS_MAIN
+static i2c_stats_t cycle_i2c;
+
+// one measurement of all sensors, takes as long as the slowest sensor
+static uint32_t read_sensors() {
+	uint32_t start = mono_millis();
+	i2c_stats_t i2c = *i2c_stats();
+	int done = 0;
+
+	sensors_schedule();
+	while (done != (1 << ARRAY_SIZE(sensor_list)) - 1) {
+		sensor_t *s = sensors_step();
+		if (s)
+			done |= 1 << (s - sensor_list);
+	}
+
+	// bus cost of this cycle
+	cycle_i2c.syscalls = i2c_stats()->syscalls - i2c.syscalls;
+	cycle_i2c.messages = i2c_stats()->messages - i2c.messages;
+	cycle_i2c.bytes = i2c_stats()->bytes - i2c.bytes;
+	cycle_i2c.bus = i2c_stats()->bus - i2c.bus;
+
+	return mono_millis() - start;
+}
+
 int main(int argc, char **argv) {
+	uint32_t cycle = 0;
+
 	sensors_init();
 
-	read_bh1750();
-	read_bmp085();
+	// more cycles let the BH1750 auto ranging settle
+	int cycles = argc > 1 ? atoi(argv[1]) : 1;
+	for (int i = 0; i < cycles; i++)
+		cycle = read_sensors();
 	publish_mqtt();
 
 	printf("BH1750 raw  %d\n", sensors->bh1750_raw);
 	printf("BH1750 raw2 %d\n", sensors->bh1750_raw2);
 	printf("BH1750 lux  %d lx\n", sensors->bh1750_lux);
 	printf("BH1750 prc  %d %%\n", sensors->bh1750_prc);
+	printf("BH1750 mt   %d\n", sensors->bh1750_mtreg);
 
 	printf("BMP085 temp %d (raw)\n", sensors->bmp085_utemp);
 	printf("BMP085 baro %d (raw)\n", sensors->bmp085_ubaro);
@@ -307,6 +654,9 @@ int main(int argc, char **argv) {
 	printf("BMP085 temp %0.1f °C\n", sensors->bmp085_temp);
 	printf("BMP085 baro %0.1f hPa\n", sensors->bmp085_baro);
 
+	printf("cycle %u ms, %u i2c syscalls, %u messages, %u bytes, %u us bus time\n", cycle, cycle_i2c.syscalls, cycle_i2c.messages, cycle_i2c.bytes,
+			cycle_i2c.bus);
+
 	sensors_close();
 	return 0;
 }
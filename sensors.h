@@ -13,17 +13,54 @@
 #define BH1750_OTHM			0x20
 #define BH1750_OTHM2		0x21
 #define BH1750_OTLM			0x23
+#define BH1750_MTREG_HIGH	0x40				// 01000_MT[7,6,5]
+#define BH1750_MTREG_LOW	0x60				// 011_MT[4,3,2,1,0]
+#define BH1750_MTREG_MIN	31
+#define BH1750_MTREG_DEF	69
+#define BH1750_MTREG_MAX	254
 
 #define BMP085				"BMP085"
 #define BMP085_ADDR			0x77
 #define BMP085_OVERSAMPLE	3
 
+// ms from the start of one measurement to the next
+#define BH1750_INTERVAL		1000
+#define BMP085_INTERVAL		1000
+
+// sampled series with raw history and per minute / per hour rollups
+#define SENSORS_LUX			0
+#define SENSORS_TEMP		1
+#define SENSORS_BARO		2
+#define SENSORS_SERIES		3
+
+#define SENSORS_SAMPLES		1024				// raw samples kept per series
+#define SENSORS_ROLLUPS		60					// completed minutes and hours kept per series
+
+#define SENSORS_MINUTE		60
+#define SENSORS_HOUR		3600
+
+// readings older than this many seconds are not used for decisions
+#define SENSORS_MAX_AGE		300
+
+typedef struct sensors_rollup_t {
+	time_t start;							// begin of the minute or hour
+	uint32_t count;
+	float min;
+	float max;
+	float mean;
+} sensors_rollup_t;
+
 typedef struct sensors_t {
-	// BH1750 luminousity
+	// BH1750 luminousity, time of the last successful measurement and whether the latest one succeeded
+	time_t bh1750_ts;
+	int bh1750_valid;
+
+	// raw counts scaled to the default measurement time, so thresholds stay comparable
 	unsigned int bh1750_raw;
 	unsigned int bh1750_raw2;
 	unsigned int bh1750_lux;
 	unsigned int bh1750_prc;
+	unsigned int bh1750_mtreg;
 
 	// BMP085 calibration data
 	int bmp085_ac1;
@@ -38,14 +75,19 @@ typedef struct sensors_t {
 	int bmp085_mc;
 	int bmp085_md;
 
-	// BMP085 temperature + barometric pressure
+	// BMP085 temperature + barometric pressure, time and validity as for the BH1750
+	time_t bmp085_ts;
+	int bmp085_valid;
 	float bmp085_temp;
 	unsigned int bmp085_utemp;
 	float bmp085_baro;
 	unsigned int bmp085_ubaro;
 } sensors_t;
 
-extern sensors_t *sensors;
-
 int sensors_init(void);
 void sensors_close(void);
+
+void sensors_snapshot(sensors_t *snapshot);
+
+int sensors_rollup(int series, int period, int ago, sensors_rollup_t *rollup);
+int sensors_samples(int series, time_t *ts, float *values, int count);
@@ -56,6 +56,22 @@ int elevate_realtime(int cpu) {
 	return 0;
 }
 
+// CLOCK_MONOTONIC in us, wraps after about 71 minutes, differences stay valid as uint32_t
+uint32_t mono_micros() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// CLOCK_MONOTONIC in ms, 64 bit for absolute deadlines, truncated to uint32_t for intervals
+uint64_t mono_millis() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
 void xlog_init(int output, const char *filename) {
 	xlog_output = output;
 
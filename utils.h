@@ -13,6 +13,9 @@
 
 int elevate_realtime(int cpu);
 
+uint32_t mono_micros();
+uint64_t mono_millis();
+
 void xlog_init(int, const char *filename);
 void xlog(const char *format, ...);
 void xlog_close(void);
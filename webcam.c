@@ -61,7 +61,8 @@ void webcam_close() {
 static void* webcam_loop(void *arg) {
 	time_t now_ts;
 	struct tm *now;
-	int afternoon;
+	int afternoon, fresh;
+	sensors_t s;
 
 	if (pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL)) {
 		xlog("Error setting pthread_setcancelstate");
@@ -72,7 +73,8 @@ static void* webcam_loop(void *arg) {
 	sleep(15);
 
 	// state unknown (e.g. system startup) --> check need for switching on
-	if (sensors->bh1750_raw2 > WEBCAM_SUNRISE)
+	sensors_snapshot(&s);
+	if (s.bh1750_valid && s.bh1750_raw2 > WEBCAM_SUNRISE)
 		start();
 	else
 		stop();
@@ -82,20 +84,24 @@ static void* webcam_loop(void *arg) {
 		now = localtime(&now_ts);
 		afternoon = now->tm_hour < 12 ? 0 : 1;
 
-		if (afternoon && webcam_on) {
+		// no decisions on failed or outdated readings
+		sensors_snapshot(&s);
+		fresh = s.bh1750_valid && now_ts - s.bh1750_ts < SENSORS_MAX_AGE;
+
+		if (fresh && afternoon && webcam_on) {
 			// evening and on --> check if need to switch off
 			// xlog("awaiting WEBCAM_SUNDOWN at %i", value);
-			if (sensors->bh1750_raw2 < WEBCAM_SUNDOWN) {
-				xlog("reached WEBCAM_SUNDOWN at bh1750_raw2=%d", sensors->bh1750_raw2);
+			if (s.bh1750_raw2 < WEBCAM_SUNDOWN) {
+				xlog("reached WEBCAM_SUNDOWN at bh1750_raw2=%d", s.bh1750_raw2);
 				stop_timelapse();
 			}
 		}
 
-		if (!afternoon && !webcam_on) {
+		if (fresh && !afternoon && !webcam_on) {
 			// morning and off --> check if need to switch on
 			// xlog("awaiting WEBCAM_SUNRISE at %i", value);
-			if (sensors->bh1750_raw2 > WEBCAM_SUNRISE) {
-				xlog("reached WEBCAM_SUNRISE at bh1750_raw2=%d", sensors->bh1750_raw2);
+			if (s.bh1750_raw2 > WEBCAM_SUNRISE) {
+				xlog("reached WEBCAM_SUNRISE at bh1750_raw2=%d", s.bh1750_raw2);
 				start_reset();
 			}
 		}
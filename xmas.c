@@ -21,8 +21,8 @@ static void* xmas_loop(void *arg);
 static void send_on(const timing_t *timing) {
 	int index = timing->channel - 'A';
 	if (!channel_status[index]) {
-		xlog("flamingo_send_FA500 %d %c 1\n", timing->remote, timing->channel);
-		flamingo_send_FA500(timing->remote, timing->channel, 1, -1);
+		xlog("flamingo_submit_FA500 %d %c 1\n", timing->remote, timing->channel);
+		flamingo_submit_FA500(timing->remote, timing->channel, 1, -1, FLAMINGO_PRIO_NORMAL, NULL, NULL);
 		channel_status[index] = 1;
 	}
 }
@@ -30,13 +30,13 @@ static void send_on(const timing_t *timing) {
 static void send_off(const timing_t *timing) {
 	int index = timing->channel - 'A';
 	if (channel_status[index]) {
-		xlog("flamingo_send_FA500 %d %c 0\n", timing->remote, timing->channel);
-		flamingo_send_FA500(timing->remote, timing->channel, 0, -1);
+		xlog("flamingo_submit_FA500 %d %c 0\n", timing->remote, timing->channel);
+		flamingo_submit_FA500(timing->remote, timing->channel, 0, -1, FLAMINGO_PRIO_NORMAL, NULL, NULL);
 		channel_status[index] = 0;
 	}
 }
 
-static void process(struct tm *now, const timing_t *timing) {
+static void process(struct tm *now, const timing_t *timing, const sensors_t *s, int fresh) {
 	int afternoon = now->tm_hour < 12 ? 0 : 1;
 	int curr = now->tm_hour * 60 + now->tm_min;
 	int from = timing->on_h * 60 + timing->on_m;
@@ -50,8 +50,8 @@ static void process(struct tm *now, const timing_t *timing) {
 			if (afternoon) {
 				// evening: check if sundown is reached an switch on
 				// xlog("in ON time, waiting for XMAS_SUNDOWN");
-				if (sensors->bh1750_raw2 < XMAS_SUNDOWN) {
-					xlog("reached XMAS_SUNDOWN at bh1750_raw2=%d", sensors->bh1750_raw2);
+				if (fresh && s->bh1750_raw2 < XMAS_SUNDOWN) {
+					xlog("reached XMAS_SUNDOWN at bh1750_raw2=%d", s->bh1750_raw2);
 					send_on(timing);
 				}
 			} else {
@@ -71,8 +71,8 @@ static void process(struct tm *now, const timing_t *timing) {
 			} else {
 				// morning: check if sunrise is reached an switch off
 				// xlog("in OFF time, waiting for XMAS_SUNRISE");
-				if (sensors->bh1750_raw2 > XMAS_SUNRISE) {
-					xlog("reached XMAS_SUNRISE at bh1750_raw2=%d", sensors->bh1750_raw2);
+				if (fresh && s->bh1750_raw2 > XMAS_SUNRISE) {
+					xlog("reached XMAS_SUNRISE at bh1750_raw2=%d", s->bh1750_raw2);
 					send_off(timing);
 				}
 			}
@@ -114,6 +114,11 @@ static void* xmas_loop(void *arg) {
 	while (1) {
 		time_t now_ts = time(NULL);
 		struct tm *now = localtime(&now_ts);
+		sensors_t s;
+
+		// no decisions on failed or outdated readings
+		sensors_snapshot(&s);
+		int fresh = s.bh1750_valid && now_ts - s.bh1750_ts < SENSORS_MAX_AGE;
 
 		for (int i = 0; i < ARRAY_SIZE(timings); i++) {
 			const timing_t *timing = &timings[i];
@@ -125,7 +130,7 @@ static void* xmas_loop(void *arg) {
 				continue;
 
 			// xlog("processing timing[%i]", i);
-			process(now, timing);
+			process(now, timing, &s, fresh);
 		}
 
 		sleep(60);